@@ -0,0 +1,33 @@
+#ifndef _NIU_ALLOCATOR_H_
+#define _NIU_ALLOCATOR_H_
+
+#include <cstddef>
+#include <memory>
+
+namespace niu {
+// -- allocator ---------------------------------------------------------------
+// alignment of every pixel buffer, one cache line
+std::size_t const buffer_alignment = 64;
+
+// Returns 'size' bytes aligned to buffer_alignment. While pooling is on,
+// released buffers go back to a process-wide pool and are handed out again
+// for the same size, so batch jobs with same-sized images stop hitting
+// malloc and page faults.
+// Buffers of 2 MiB and more are 2 MiB aligned and advised to use huge
+// pages where supported. The contents are zeroed only when 'zero' is set.
+std::shared_ptr<unsigned char>
+allocate_buffer(
+        std::size_t size,
+        bool zero = true);
+
+// turns the pool on for a batch of images; turning it off frees the pooled
+// buffers, so single images never keep buffers they can't reuse
+void
+set_buffer_pooling(bool enabled);
+
+// frees all pooled buffers
+void
+release_buffers();
+}  // namespace niu
+
+#endif  // _NIU_ALLOCATOR_H_
@@ -0,0 +1,100 @@
+#ifndef _NIU_ANY_IMAGE_H_
+#define _NIU_ANY_IMAGE_H_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include "image.h"
+
+namespace niu {
+// -- PixelType ---------------------------------------------------------------
+enum class PixelType
+{
+    gray8,
+    gray_alpha8,
+    rgb8,
+    rgba8,
+    gray16,
+    gray_alpha16,
+    rgb16,
+    rgba16,
+};
+
+// -- AnyImage declaration ----------------------------------------------------
+// Image in the pixel format it was loaded with, dispatching every operation
+// to the BasicImage instantiation for that format at run time. A gray PNG
+// stays one byte per pixel from load to save; colors given as RGBA are
+// converted to the format. Copy-on-write like Image.
+class AnyImage
+{
+public:
+    // -- constructor ---------------------------------------------------------
+    AnyImage();
+
+    // -- functions -----------------------------------------------------------
+    AnyImage
+    clone() const;
+
+    bool
+    load(std::string const& file);
+
+    bool
+    save(std::string const& file,
+            Format format = Format::png,
+            EncodeOptions const& options = EncodeOptions()) const;
+
+    // saves the image upscaled n times without building it in memory, as
+    // Image::save_upscaled
+    bool
+    save_upscaled(
+            std::string const& file,
+            std::size_t n,
+            Format format = Format::png,
+            EncodeOptions const& options = EncodeOptions()) const;
+
+    // -- modifications -------------------------------------------------------
+    void
+    inverse_x();
+
+    void
+    inverse_y();
+
+    void
+    upscale(std::size_t n);
+
+    void
+    set_color(
+            std::size_t x,
+            std::size_t y,
+            Color color);
+
+    void
+    fill(Color color);
+
+    // -- data ----------------------------------------------------------------
+    PixelType
+    type() const;
+
+    std::size_t
+    width() const;
+
+    std::size_t
+    height() const;
+
+private:
+    class Holder;
+
+    template <class F>
+    class Model;
+
+    // gives this image its own holder before modification
+    Holder&
+    detach();
+
+    // -- data ----------------------------------------------------------------
+    std::shared_ptr<Holder> m_image;
+};
+}  // namespace niu
+
+#endif  // _NIU_ANY_IMAGE_H_
@@ -0,0 +1,45 @@
+#ifndef _NIU_ATLAS_H_
+#define _NIU_ATLAS_H_
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "image.h"
+
+namespace niu {
+// -- atlas -------------------------------------------------------------------
+// Packs rectangles of 'sizes' into a bin 'width' pixels wide (0 - the
+// smallest power of two that fits them) with the MaxRects algorithm: free
+// space is kept as maximal, overlapping rectangles and each one goes where
+// its bottom edge ends up lowest. 'padding' pixels are left between
+// rectangles. Returns the bin size, the top left corners go to 'positions'.
+// Throws std::invalid_argument if a rectangle is wider than the bin.
+Vector2
+pack_rects(
+        std::vector<Vector2> const& sizes,
+        std::size_t width,
+        std::size_t padding,
+        std::vector<Vector2>& positions);
+
+// Packs 'sprites' with pack_rects and copies them into a single image in one
+// pass; pixels between the sprites are transparent.
+Image
+make_atlas(
+        std::vector<Image> const& sprites,
+        std::size_t width,
+        std::size_t padding,
+        std::vector<Vector2>& positions);
+
+// Renders a tilemap: every character of 'rows' is a cell of the size of the
+// largest sprite, with sprites.at(symbol) copied to its top left corner;
+// ' ' and cells past the end of a row stay transparent. Tile rows are
+// rendered in parallel. Throws std::invalid_argument on unknown symbols.
+Image
+render_tilemap(
+        std::vector<std::string> const& rows,
+        std::map<char, Image> const& sprites);
+}  // namespace niu
+
+#endif  // _NIU_ATLAS_H_
@@ -0,0 +1,44 @@
+#ifndef _NIU_BATCH_H_
+#define _NIU_BATCH_H_
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace niu {
+// -- BatchResult -------------------------------------------------------------
+struct BatchResult
+{
+    std::size_t succeeded;
+    std::size_t failed;
+};
+
+// -- batch -------------------------------------------------------------------
+bool
+is_batch_input(
+        std::string const& input);
+
+std::vector<std::string>
+expand_input(
+        std::string const& input);
+
+bool
+read_input_list(
+        std::string const& file,
+        std::vector<std::string>& inputs);
+
+std::string
+make_output_path(
+        std::string const& output,
+        std::string const& input,
+        std::string const& ext);
+
+BatchResult
+run_batch(
+        std::vector<std::string> const& inputs,
+        std::size_t jobs,
+        std::function<bool(std::string const&, std::string&)> const& task);
+}  // namespace niu
+
+#endif  // _NIU_BATCH_H_
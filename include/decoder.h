@@ -0,0 +1,66 @@
+#ifndef _NIU_DECODER_H_
+#define _NIU_DECODER_H_
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+namespace niu {
+// -- PngRegion ---------------------------------------------------------------
+// Rectangle of the image to decode, zero width or height - up to the edge.
+struct PngRegion
+{
+    std::size_t x = 0;
+    std::size_t y = 0;
+    std::size_t width = 0;
+    std::size_t height = 0;
+};
+
+// -- PixelAllocator ----------------------------------------------------------
+// Returns storage for width * height RGBA pixels, rows without padding.
+typedef std::function<unsigned char*(std::size_t width,
+                                     std::size_t height)> PixelAllocator;
+
+// -- RawAllocator ------------------------------------------------------------
+// Returns storage for width * height pixels of 'channels' samples with
+// 'bit_depth' bits (8 or 16) each, rows without padding.
+typedef std::function<unsigned char*(std::size_t width,
+                                     std::size_t height,
+                                     std::size_t channels,
+                                     std::size_t bit_depth)> RawAllocator;
+
+// -- RowConsumer -------------------------------------------------------------
+// Receives row 'y' of the image as 8-bit RGBA pixels, rows come in order.
+typedef std::function<void(std::size_t y,
+                           unsigned char const* row)> RowConsumer;
+
+// -- decoder -----------------------------------------------------------------
+// Decodes the region of a PNG file with libpng one row at a time straight
+// into 8-bit RGBA storage from 'allocate' (palette, gray, 16-bit and missing
+// alpha are converted by libpng transforms). Only the region columns are
+// kept, and decoding stops after the last region row, so memory is
+// proportional to the region and time to its bottom edge. Interlaced images
+// keep full region rows until the last pass.
+bool
+read_png(
+        std::string const& file,
+        PngRegion const& region,
+        PixelAllocator const& allocate);
+
+// Decodes a whole PNG file keeping its channels: gray, gray + alpha, RGB or
+// RGBA (palette and tRNS are expanded, samples below 8 bits widened) with
+// 8 or 16-bit samples, the latter in host byte order.
+bool
+read_png_raw(
+        std::string const& file,
+        RawAllocator const& allocate);
+
+// Decodes a whole PNG file to 8-bit RGBA like read_png, but hands each row to
+// 'consume' instead of storing the image.
+bool
+read_png_rows(
+        std::string const& file,
+        RowConsumer const& consume);
+}  // namespace niu
+
+#endif  // _NIU_DECODER_H_
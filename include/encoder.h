@@ -0,0 +1,41 @@
+#ifndef _NIU_ENCODER_H_
+#define _NIU_ENCODER_H_
+
+#include <cstddef>
+#include <string>
+
+#include "image.h"
+
+namespace niu {
+// -- encoder -----------------------------------------------------------------
+// Writes 8-bit RGBA PNG requesting one row at a time from the producer, so
+// only a few rows are ever resident besides the producer's own data. With
+// options.palette the rows are scanned once beforehand, and images with at
+// most 256 colors are written as indexed PNG (1-8 bit, PLTE plus tRNS). With
+// more than one thread the scanlines are cut into stripes that are filtered
+// and deflated concurrently (pigz style: sync flushed raw deflate streams
+// primed with the previous stripe as dictionary, combined Adler-32) and
+// written as a standard zlib stream in IDAT chunks.
+bool
+write_png(
+        std::string const& file,
+        std::size_t width,
+        std::size_t height,
+        RowProducer const& producer,
+        EncodeOptions const& options);
+
+// Writes gray (1), gray + alpha (2), RGB (3) or RGBA (4 channels) PNG with
+// 8 or 16 bits per sample. Rows hold width * channels samples as stored in
+// the file, 16-bit samples big-endian; options.palette is ignored.
+bool
+write_png_raw(
+        std::string const& file,
+        std::size_t width,
+        std::size_t height,
+        std::size_t channels,
+        std::size_t bit_depth,
+        RowProducer const& producer,
+        EncodeOptions const& options);
+}  // namespace niu
+
+#endif  // _NIU_ENCODER_H_
@@ -1,10 +1,13 @@
 #ifndef _NIU_IMAGE_H_
 #define _NIU_IMAGE_H_
 
+#include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <functional>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace niu {
 // -- Vector2 -----------------------------------------------------------------
@@ -19,6 +22,30 @@ operator >>(
         std::istream& os,
         Vector2& obj);
 
+// -- Point -------------------------------------------------------------------
+typedef union
+{
+    struct { std::ptrdiff_t x, y; };
+} Point;
+
+std::istream&
+operator >>(
+        std::istream& os,
+        Point& obj);
+
+// ----------------------------------------------------------------------------
+// Clips 'size' pixels placed at 'pos' (may be negative) to [0, limit): the
+// first visible pixel goes to 'from', its position to 'to' and the number of
+// visible pixels to 'count' (0 if none).
+void
+clip_span(
+        std::ptrdiff_t pos,
+        std::size_t size,
+        std::size_t limit,
+        std::size_t& from,
+        std::size_t& to,
+        std::size_t& count);
+
 // -- Color -------------------------------------------------------------------
 typedef union
 {
@@ -38,7 +65,120 @@ enum class Format
     png,
 };
 
+// -- BlendMode ---------------------------------------------------------------
+// How merged pixels are combined with the destination. 'mask' copies every
+// pixel that is not fully transparent, 'copy' copies all of them; the rest
+// are separable blend modes composited source-over.
+enum class BlendMode
+{
+    mask,
+    copy,
+    over,
+    multiply,
+    add,
+    screen,
+};
+
+std::istream&
+operator >>(
+        std::istream& os,
+        BlendMode& obj);
+
+// -- ResampleFilter ----------------------------------------------------------
+// Reconstruction filter used by resize: box (nearest / area average),
+// triangle, Catmull-Rom cubic or 3-lobe Lanczos.
+enum class ResampleFilter
+{
+    box,
+    bilinear,
+    bicubic,
+    lanczos,
+};
+
+std::istream&
+operator >>(
+        std::istream& os,
+        ResampleFilter& obj);
+
+// -- RowFilter ---------------------------------------------------------------
+enum class RowFilter
+{
+    adaptive,
+    none,
+    sub,
+    up,
+    average,
+    paeth,
+};
+
+std::istream&
+operator >>(
+        std::istream& os,
+        RowFilter& obj);
+
+// -- Strategy ----------------------------------------------------------------
+enum class Strategy
+{
+    automatic,
+    standard,
+    filtered,
+    huffman,
+    rle,
+    fixed,
+};
+
+std::istream&
+operator >>(
+        std::istream& os,
+        Strategy& obj);
+
+// -- EncodeOptions -----------------------------------------------------------
+struct EncodeOptions
+{
+    // zlib level 0-9, -1 - zlib default
+    int level = -1;
+    RowFilter filter = RowFilter::adaptive;
+    // automatic - filtered for filtered rows, standard otherwise
+    Strategy strategy = Strategy::automatic;
+    // number of deflate workers, 0 - one per core
+    std::size_t threads = 1;
+    // write indexed PNG when there are at most 256 distinct colors
+    bool palette = false;
+};
+
+// -- ImageInfo ---------------------------------------------------------------
+// Image properties read from the file header, without decoding pixels.
+struct ImageInfo
+{
+    std::size_t width = 0;
+    std::size_t height = 0;
+    // channels stored in the file (palette images count as RGB)
+    std::size_t channels = 0;
+    // bits per channel (per index for palette images)
+    std::size_t bit_depth = 0;
+    Format format = Format::unknown;
+};
+
+// -- ColorPoint --------------------------------------------------------------
+struct ColorPoint
+{
+    std::size_t x;
+    std::size_t y;
+    Color color;
+};
+
+// -- RowProducer -------------------------------------------------------------
+// Returns pointer to RGBA pixels of row 'y': either to its own storage or to
+// 'buffer' (width * Image::channels bytes) after filling it. Rows are
+// requested in order and 'buffer' keeps its contents between calls.
+typedef std::function<unsigned char const*(std::size_t y,
+                                           unsigned char* buffer)> RowProducer;
+
+class ImageView;
+
 // -- Image declaration -------------------------------------------------------
+// Copies share the pixels until one of them is modified (copy-on-write);
+// clone() makes an independent copy at once.
 class Image
 {
 public:
@@ -47,23 +187,94 @@ public:
     // -- constructor ---------------------------------------------------------
     Image();
 
+    Image(Image const&) = default;
+
+    Image(Image&&) noexcept = default;
+
+    Image&
+    operator =(Image const&) = default;
+
+    Image&
+    operator =(Image&&) noexcept = default;
+
     // -- static --------------------------------------------------------------
     static Image
     make_image(
             std::size_t width,
             std::size_t height);
 
+    static Image
+    make_image(ImageView const& view);
+
+    static bool
+    save_rows(
+            std::string const& file,
+            std::size_t width,
+            std::size_t height,
+            RowProducer const& producer,
+            Format format = Format::png,
+            EncodeOptions const& options = EncodeOptions());
+
+    // rows of 'channels' samples with 'bit_depth' bits each, 16-bit samples
+    // big-endian
+    static bool
+    save_rows(
+            std::string const& file,
+            std::size_t width,
+            std::size_t height,
+            std::size_t channels,
+            std::size_t bit_depth,
+            RowProducer const& producer,
+            Format format = Format::png,
+            EncodeOptions const& options = EncodeOptions());
+
+    // reads only the PNG signature and IHDR (the header via stb_image for
+    // other formats)
+    static bool
+    probe(std::string const& file,
+            ImageInfo& info);
+
     // -- functions -----------------------------------------------------------
+    Image
+    clone() const;
+
     bool
     load(std::string const& file);
 
+    // loads only the w x h region at (x, y), zero w or h - up to the edge;
+    // PNG files are decoded just down to the last row of the region
+    bool
+    load_region(
+            std::string const& file,
+            std::size_t x,
+            std::size_t y,
+            std::size_t w,
+            std::size_t h);
+
     bool
     save(std::string const& file,
-            Format format = Format::png) const;
+            Format format = Format::png,
+            EncodeOptions const& options = EncodeOptions()) const;
+
+    bool
+    save_upscaled(
+            std::string const& file,
+            std::size_t n,
+            Format format = Format::png,
+            EncodeOptions const& options = EncodeOptions()) const;
 
     bool
     dump(std::string const& file) const;
 
+    ImageView
+    view() const;
+
+    ImageView
+    view(std::size_t x,
+            std::size_t y,
+            std::size_t w,
+            std::size_t h) const;
+
     Image
     sub_image(
             std::size_t x,
@@ -73,7 +284,13 @@ public:
 
     void
     merge(Image const& image,
-            Vector2 const& offset);
+            Point const& offset,
+            BlendMode mode = BlendMode::mask);
+
+    void
+    merge(ImageView const& image,
+            Point const& offset,
+            BlendMode mode = BlendMode::mask);
 
     // -- modifications -------------------------------------------------------
     void
@@ -82,6 +299,21 @@ public:
     void
     inverse_y();
 
+    // swaps rows and columns
+    void
+    transpose();
+
+    Image
+    transposed() const;
+
+    // rotates clockwise by a multiple of 90 degrees (negative - counter
+    // clockwise)
+    void
+    rotate(int degrees);
+
+    Image
+    rotated(int degrees) const;
+
     void
     upscale(std::size_t n);
 
@@ -89,12 +321,35 @@ public:
     upscaled(
             std::size_t n) const;
 
+    void
+    resize(std::size_t width,
+            std::size_t height,
+            ResampleFilter filter = ResampleFilter::lanczos);
+
+    // resamples to width x height, zero side keeps the aspect ratio
+    Image
+    resized(std::size_t width,
+            std::size_t height,
+            ResampleFilter filter = ResampleFilter::lanczos) const;
+
+    // successive half size levels down to 1x1 (or 'levels' of them, if not
+    // zero), each one resampled from the previous level
+    std::vector<Image>
+    pyramid(std::size_t levels = 0,
+            ResampleFilter filter = ResampleFilter::box) const;
+
     void
     set_color(
             std::size_t x,
             std::size_t y,
             Color color);
 
+    // sets many pixels at once: points are bucketed by row and the rows are
+    // written in parallel; a later point wins over an earlier one at the
+    // same position
+    void
+    set_colors(std::vector<ColorPoint> const& points);
+
     void
     fill(Color color);
 
@@ -105,12 +360,90 @@ public:
     std::size_t
     height() const noexcept;
 
+    // start of the pixels for writing, rows without padding; the image gets
+    // its own buffer first, so disjoint rows may then be written from
+    // several threads until the image is copied or modified otherwise
+    unsigned char*
+    data();
+
 private:
+    // gives the image its own buffer before modification if it is shared
+    // with copies or views; keep - copy the pixels into it
+    void
+    detach(bool keep);
+
+    // pixels are left for the caller to overwrite
+    static Image
+    make_uninitialized(
+            std::size_t width,
+            std::size_t height);
+
     // -- data ----------------------------------------------------------------
     std::size_t m_width;
     std::size_t m_height;
     std::shared_ptr<unsigned char> m_data;
 };
+
+// -- ImageView declaration ---------------------------------------------------
+// Read-only window (origin, size and row stride) into the pixels of an
+// image. It shares the pixel buffer, so cropping is O(1) and the view stays
+// valid after the image itself is gone. Modifying the image detaches it from
+// the buffer, so a view keeps the pixels it was made from.
+class ImageView
+{
+public:
+    // -- constructor ---------------------------------------------------------
+    ImageView();
+
+    ImageView(
+            std::shared_ptr<unsigned char> const& data,
+            std::size_t offset,
+            std::size_t width,
+            std::size_t height,
+            std::size_t stride);
+
+    // -- functions -----------------------------------------------------------
+    ImageView
+    sub_view(
+            std::size_t x,
+            std::size_t y,
+            std::size_t w,
+            std::size_t h) const;
+
+    bool
+    save(std::string const& file,
+            Format format = Format::png,
+            EncodeOptions const& options = EncodeOptions()) const;
+
+    bool
+    save_upscaled(
+            std::string const& file,
+            std::size_t n,
+            Format format = Format::png,
+            EncodeOptions const& options = EncodeOptions()) const;
+
+    // -- data ----------------------------------------------------------------
+    unsigned char const*
+    row(std::size_t y) const noexcept;
+
+    std::size_t
+    width() const noexcept;
+
+    std::size_t
+    height() const noexcept;
+
+    // distance between rows in bytes
+    std::size_t
+    stride() const noexcept;
+
+private:
+    // -- data ----------------------------------------------------------------
+    std::shared_ptr<unsigned char> m_data;
+    std::size_t m_offset;
+    std::size_t m_width;
+    std::size_t m_height;
+    std::size_t m_stride;
+};
 }  // namespace niu
 
 #endif  // _NIU_IMAGE_H_
@@ -0,0 +1,92 @@
+#ifndef _NIU_IO_H_
+#define _NIU_IO_H_
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace niu {
+// -- MappedFile declaration --------------------------------------------------
+// Read-only contents of a whole file. The file is memory mapped where the
+// platform allows it, so decoders read the page cache directly instead of
+// copying through stdio buffers; otherwise it is read at once.
+class MappedFile
+{
+public:
+    // -- constructor ---------------------------------------------------------
+    MappedFile();
+
+    MappedFile(MappedFile const&) = delete;
+
+    MappedFile&
+    operator =(MappedFile const&) = delete;
+
+    ~MappedFile();
+
+    // -- functions -----------------------------------------------------------
+    bool
+    open(std::string const& file);
+
+    void
+    close();
+
+    // -- data ----------------------------------------------------------------
+    unsigned char const*
+    data() const noexcept;
+
+    std::size_t
+    size() const noexcept;
+
+private:
+    // -- data ----------------------------------------------------------------
+    void* m_map;
+    std::size_t m_size;
+    std::vector<unsigned char> m_buffer;
+};
+
+// -- OutputFile declaration --------------------------------------------------
+// Write-only file with a large buffer of its own, written out by a single
+// call when full and on close. Writes larger than the buffer bypass it.
+class OutputFile
+{
+public:
+    static std::size_t const default_capacity = std::size_t(1) << 20;
+
+    // -- constructor ---------------------------------------------------------
+    explicit
+    OutputFile(std::size_t capacity = default_capacity);
+
+    OutputFile(OutputFile const&) = delete;
+
+    OutputFile&
+    operator =(OutputFile const&) = delete;
+
+    // closes the file without reporting errors, use close() to check them
+    ~OutputFile();
+
+    // -- functions -----------------------------------------------------------
+    bool
+    open(std::string const& file);
+
+    bool
+    write(void const* data,
+            std::size_t size);
+
+    // flushes the buffer and closes the file, false if any write failed
+    bool
+    close();
+
+private:
+    bool
+    flush();
+
+    // -- data ----------------------------------------------------------------
+    std::FILE* m_file;
+    std::size_t m_capacity;
+    std::vector<unsigned char> m_buffer;
+    bool m_good;
+};
+}  // namespace niu
+
+#endif  // _NIU_IO_H_
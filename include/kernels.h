@@ -0,0 +1,63 @@
+#ifndef _NIU_KERNELS_H_
+#define _NIU_KERNELS_H_
+
+#include <cstddef>
+
+#include "image.h"
+
+namespace niu {
+namespace kernels {
+// -- kernels -----------------------------------------------------------------
+// Pixel loops over runs of RGBA pixels. Each kernel has SSE2 and AVX2
+// versions picked at runtime by the CPU features, and a scalar fallback for
+// other targets. Pointers don't need any particular alignment.
+
+// sets 'count' pixels to 'color'
+void
+fill(unsigned char* dst,
+        std::size_t count,
+        Color color);
+
+// copies source pixels over destination pixels, skipping transparent ones
+void
+merge_masked(
+        unsigned char* dst,
+        unsigned char const* src,
+        std::size_t count);
+
+// writes every source pixel 'n' times in a row, dst holds count * n pixels
+void
+replicate(
+        unsigned char* dst,
+        unsigned char const* src,
+        std::size_t count,
+        std::size_t n);
+
+// composites source pixels over destination pixels with a separable blend
+// mode (over, multiply, add or screen) on straight, non-premultiplied alpha
+void
+blend(unsigned char* dst,
+        unsigned char const* src,
+        std::size_t count,
+        BlendMode mode);
+
+// mirrors a row of 'count' pixels in place
+void
+reverse(unsigned char* row,
+        std::size_t count);
+
+// writes source column x as destination row x: pixel (x, y) goes to
+// dst + x * dst_stride + y pixels, or - y pixels if 'reverse' is set
+void
+transpose(
+        unsigned char* dst,
+        std::ptrdiff_t dst_stride,
+        bool reverse,
+        unsigned char const* src,
+        std::size_t src_stride,
+        std::size_t width,
+        std::size_t height);
+}  // namespace kernels
+}  // namespace niu
+
+#endif  // _NIU_KERNELS_H_
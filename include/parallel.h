@@ -0,0 +1,124 @@
+#ifndef _NIU_PARALLEL_H_
+#define _NIU_PARALLEL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace niu {
+// -- parallel ----------------------------------------------------------------
+inline std::size_t
+hardware_threads()
+{
+    std::size_t res = std::thread::hardware_concurrency();
+    return res != 0 ? res : 1;
+}
+
+// ----------------------------------------------------------------------------
+inline std::atomic<std::size_t>&
+threads_storage()
+{
+    static std::atomic<std::size_t> res(1);
+    return res;
+}
+
+// ----------------------------------------------------------------------------
+// Number of workers a single image operation may use, 1 by default so that
+// batch jobs don't oversubscribe the cores.
+inline std::size_t
+threads()
+{
+    std::size_t const res = threads_storage();
+    return res != 0 ? res : hardware_threads();
+}
+
+// ----------------------------------------------------------------------------
+// Sets the number of workers per image operation, 0 - one per core.
+inline void
+set_threads(std::size_t value)
+{
+    threads_storage() = value;
+}
+
+// ----------------------------------------------------------------------------
+// Calls func(i) for every i in [0, count) on up to 'threads' workers
+// (0 - one per core). Work items are handed out one by one, so uneven items
+// balance themselves. The first exception thrown by func is rethrown after
+// all workers are joined.
+inline void
+parallel_for(
+        std::size_t count,
+        std::size_t threads,
+        std::function<void(std::size_t)> const& func)
+{
+    if (threads == 0) {
+        threads = hardware_threads();
+    }
+    threads = std::min(threads, count);
+    if (threads <= 1) {
+        for (std::size_t i = 0; i < count; ++i) {
+            func(i);
+        }
+        return;
+    }
+    std::atomic<std::size_t> next(0);
+    std::exception_ptr error = nullptr;
+    std::mutex mutex;
+    auto worker = [&] ()
+    {
+        for (std::size_t i = next++; i < count; i = next++) {
+            try {
+                func(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next = count;
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    pool.reserve(threads - 1);
+    for (std::size_t i = 1; i < threads; ++i) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : pool) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Splits [0, count) into contiguous bands and calls func(begin, end) for
+// each of them on threads() workers. Bands keep rows of one worker adjacent
+// in memory; a few more bands than workers even out the load.
+inline void
+parallel_bands(
+        std::size_t count,
+        std::function<void(std::size_t, std::size_t)> const& func)
+{
+    std::size_t const workers = threads();
+    if (workers <= 1 || count <= 1) {
+        if (count != 0) {
+            func(0, count);
+        }
+        return;
+    }
+    std::size_t const bands = std::min(count, workers * 4);
+    parallel_for(bands, workers, [&] (std::size_t i)
+    {
+        func(count * i / bands, count * (i + 1) / bands);
+    });
+}
+}  // namespace niu
+
+#endif  // _NIU_PARALLEL_H_
@@ -0,0 +1,147 @@
+#ifndef _NIU_PIPELINE_H_
+#define _NIU_PIPELINE_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "any_image.h"
+#include "image.h"
+#include "tiled_image.h"
+
+namespace niu {
+// -- Pipeline declaration ----------------------------------------------------
+// Chain of image operations applied in memory between a single load and a
+// single save. Adjacent steps are fused when added: consecutive upscales are
+// multiplied together, and a fill drops every preceding step it would
+// overwrite anyway.
+class Pipeline
+{
+public:
+    // -- constructor ---------------------------------------------------------
+    Pipeline();
+
+    // -- steps ---------------------------------------------------------------
+    void
+    add_upscale(
+            std::size_t n);
+
+    void
+    add_resize(
+            std::size_t width,
+            std::size_t height,
+            ResampleFilter filter = ResampleFilter::lanczos);
+
+    void
+    add_fill(
+            Color color);
+
+    void
+    add_set_color(
+            Color color,
+            std::vector<Vector2> const& positions);
+
+    // positions with their colors, e.g. from read_points
+    void
+    add_set_colors(
+            std::vector<ColorPoint> const& points);
+
+    void
+    add_merge(
+            Image const& image,
+            Point const& offset,
+            BlendMode mode = BlendMode::mask);
+
+    void
+    add_inverse_x();
+
+    void
+    add_inverse_y();
+
+    void
+    add_transpose();
+
+    // clockwise, multiple of 90 degrees
+    void
+    add_rotate(int degrees);
+
+    // parses one step in text form, e.g. 'upscale 2', 'resize W H [FILTER]',
+    // 'fill FF0000FF', 'set_colors FILE [RRGGBBAA]', 'merge FILE X Y [MODE]'
+    // or 'rotate 90'
+    void
+    add_step(
+            std::string const& step);
+
+    bool
+    load_recipe(
+            std::string const& file);
+
+    // -- functions -----------------------------------------------------------
+    void
+    apply(Image& image) const;
+
+    // keeps the pixel format of the image, see keeps_format()
+    void
+    apply(AnyImage& image) const;
+
+    // only fill, set_color and merge steps, others throw
+    // std::invalid_argument
+    void
+    apply(TiledImage& image) const;
+
+    // true if every step works on an image of 'channels' channels in its
+    // own pixel format: no merge, resize, transpose or rotate, and no color
+    // with alpha or chroma that the format can't hold
+    bool
+    keeps_format(std::size_t channels) const noexcept;
+
+    // applies all steps except a trailing upscale and returns its factor
+    // (1 if there is none), so it can be done on the fly by save_upscaled
+    std::size_t
+    apply_deferred(Image& image) const;
+
+    std::size_t
+    apply_deferred(AnyImage& image) const;
+
+    std::size_t
+    size() const noexcept;
+
+private:
+    // -- Step ----------------------------------------------------------------
+    enum class Kind
+    {
+        upscale,
+        resize,
+        fill,
+        set_color,
+        set_colors,
+        merge,
+        inverse_x,
+        inverse_y,
+        transpose,
+        rotate,
+    };
+
+    struct Step
+    {
+        Kind kind;
+        std::size_t n;
+        Color color;
+        std::vector<Vector2> positions;
+        Image image;
+        Point offset;
+        BlendMode mode;
+        Vector2 size;
+        ResampleFilter filter;
+        std::vector<ColorPoint> points;
+    };
+
+    Step&
+    push(Kind kind);
+
+    // -- data ----------------------------------------------------------------
+    std::vector<Step> m_steps;
+};
+}  // namespace niu
+
+#endif  // _NIU_PIPELINE_H_
@@ -0,0 +1,255 @@
+#ifndef _NIU_PIXEL_IMAGE_H_
+#define _NIU_PIXEL_IMAGE_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+
+#include "allocator.h"
+#include "image.h"
+#include "parallel.h"
+
+namespace niu {
+// -- PixelFormat -------------------------------------------------------------
+// Layout of one pixel: 'N' interleaved samples of type 'T', alpha last.
+template <class T, std::size_t N>
+struct PixelFormat
+{
+    typedef T sample_type;
+
+    static std::size_t const channels = N;
+    static std::size_t const pixel_size = N * sizeof(T);
+    static std::size_t const bit_depth = sizeof(T) * 8;
+    static bool const has_alpha = N == 2 || N == 4;
+};
+
+typedef PixelFormat<uint8_t, 1> Gray8;
+typedef PixelFormat<uint8_t, 2> GrayAlpha8;
+typedef PixelFormat<uint8_t, 3> Rgb8;
+typedef PixelFormat<uint8_t, 4> Rgba8;
+typedef PixelFormat<uint16_t, 1> Gray16;
+typedef PixelFormat<uint16_t, 2> GrayAlpha16;
+typedef PixelFormat<uint16_t, 3> Rgb16;
+typedef PixelFormat<uint16_t, 4> Rgba16;
+
+// -- Pixel -------------------------------------------------------------------
+template <class F>
+struct Pixel
+{
+    typename F::sample_type value[F::channels];
+};
+
+// ----------------------------------------------------------------------------
+// RGBA color in the pixel format: gray is the BT.601 luma, 16-bit samples
+// are scaled by 257 so that 0xff maps to 0xffff
+template <class F>
+inline Pixel<F>
+to_pixel(Color color)
+{
+    typedef typename F::sample_type T;
+    unsigned const scale = (1u << F::bit_depth) / 256 + (F::bit_depth > 8 ? 1 : 0);
+    Pixel<F> res;
+    if (F::channels >= 3) {
+        res.value[0] = static_cast<T>(color.r * scale);
+        res.value[1] = static_cast<T>(color.g * scale);
+        res.value[2] = static_cast<T>(color.b * scale);
+    } else {
+        res.value[0] = static_cast<T>((color.r * 77u + color.g * 150u + color.b * 29u + 128u)
+                                      / 256u * scale);
+    }
+    if (F::has_alpha) {
+        res.value[F::channels - 1] = static_cast<T>(color.a * scale);
+    }
+    return res;
+}
+
+// -- BasicImage declaration --------------------------------------------------
+// Image kept in its native pixel format 'F'. Copy-on-write like Image.
+template <class F>
+class BasicImage
+{
+public:
+    typedef F format_type;
+    typedef typename F::sample_type sample_type;
+    typedef Pixel<F> pixel_type;
+
+    // -- constructor ---------------------------------------------------------
+    BasicImage()
+        : m_width(0),
+          m_height(0),
+          m_data()
+    {
+    }
+
+    // -- static --------------------------------------------------------------
+    // zero - clear the pixels, otherwise the caller overwrites all of them
+    static BasicImage
+    make_image(
+            std::size_t width,
+            std::size_t height,
+            bool zero = true)
+    {
+        if (height != 0 && width > std::numeric_limits<std::size_t>::max()
+                / F::pixel_size / height) {
+            throw std::overflow_error("integer overflow");
+        }
+        BasicImage res;
+        res.m_width = width;
+        res.m_height = height;
+        res.m_data = allocate_buffer(width * height * F::pixel_size, zero);
+        return res;
+    }
+
+    // -- functions -----------------------------------------------------------
+    BasicImage
+    clone() const
+    {
+        BasicImage res = make_image(m_width, m_height, false);
+        std::memcpy(res.m_data.get(), m_data.get(), m_width * m_height * F::pixel_size);
+        return res;
+    }
+
+    // -- modifications -------------------------------------------------------
+    void
+    inverse_x()
+    {
+        detach(true);
+        unsigned char tmp[F::pixel_size];
+        for (std::size_t y = 0; y < m_height; ++y) {
+            unsigned char* data = row(y);
+            for (std::size_t x = 0; x < m_width / 2; ++x) {
+                unsigned char* a = data + x * F::pixel_size;
+                unsigned char* b = data + (m_width - x - 1) * F::pixel_size;
+                std::memcpy(tmp, a, F::pixel_size);
+                std::memcpy(a, b, F::pixel_size);
+                std::memcpy(b, tmp, F::pixel_size);
+            }
+        }
+    }
+
+    void
+    inverse_y()
+    {
+        detach(true);
+        std::size_t const row_size = m_width * F::pixel_size;
+        for (std::size_t y = 0; y < m_height / 2; ++y) {
+            std::swap_ranges(row(y), row(y) + row_size, row(m_height - y - 1));
+        }
+    }
+
+    void
+    upscale(std::size_t n)
+    {
+        BasicImage res = upscaled(n);
+        std::swap(*this, res);
+    }
+
+    BasicImage
+    upscaled(
+            std::size_t n) const
+    {
+        if (n == 0 || m_width > std::numeric_limits<std::size_t>::max() / n
+                || m_height > std::numeric_limits<std::size_t>::max() / n) {
+            throw std::overflow_error("integer overflow");
+        }
+        BasicImage res = make_image(m_width * n, m_height * n, false);
+        std::size_t const row_size = res.m_width * F::pixel_size;
+        BasicImage const& src = *this;
+        // every source row is expanded once, the other n - 1 rows are copies
+        parallel_bands(m_height, [&src, &res, n, row_size] (std::size_t begin,
+                                                            std::size_t end)
+        {
+            for (std::size_t iy = begin; iy < end; ++iy) {
+                unsigned char const* from = src.row(iy);
+                unsigned char* to = res.row(iy * n);
+                for (std::size_t x = 0; x < src.width(); ++x, from += F::pixel_size) {
+                    for (std::size_t k = 0; k < n; ++k, to += F::pixel_size) {
+                        std::memcpy(to, from, F::pixel_size);
+                    }
+                }
+                for (std::size_t k = 1; k < n; ++k) {
+                    std::memcpy(res.row(iy * n + k), res.row(iy * n), row_size);
+                }
+            }
+        });
+        return res;
+    }
+
+    void
+    set_color(
+            std::size_t x,
+            std::size_t y,
+            pixel_type const& pixel)
+    {
+        if (x >= m_width || y >= m_height) {
+            throw std::invalid_argument("invalid image parameters");
+        }
+        detach(true);
+        std::memcpy(row(y) + x * F::pixel_size, pixel.value, F::pixel_size);
+    }
+
+    void
+    fill(pixel_type const& pixel)
+    {
+        std::size_t const size = m_width * m_height * F::pixel_size;
+        if (size == 0) {
+            return;
+        }
+        detach(false);
+        // one pixel, then the filled part doubled until the end
+        unsigned char* data = m_data.get();
+        std::memcpy(data, pixel.value, F::pixel_size);
+        for (std::size_t done = F::pixel_size; done < size; done *= 2) {
+            std::memcpy(data + done, data, std::min(done, size - done));
+        }
+    }
+
+    // -- data ----------------------------------------------------------------
+    unsigned char*
+    row(std::size_t y) noexcept
+    {
+        return m_data.get() + y * m_width * F::pixel_size;
+    }
+
+    unsigned char const*
+    row(std::size_t y) const noexcept
+    {
+        return m_data.get() + y * m_width * F::pixel_size;
+    }
+
+    std::size_t
+    width() const noexcept
+    {
+        return m_width;
+    }
+
+    std::size_t
+    height() const noexcept
+    {
+        return m_height;
+    }
+
+private:
+    // own buffer before modification, keep - copy the pixels into it
+    void
+    detach(bool keep)
+    {
+        if (!m_data || m_data.use_count() == 1) {
+            return;
+        }
+        BasicImage res = keep ? clone() : make_image(m_width, m_height, false);
+        m_data = std::move(res.m_data);
+    }
+
+    // -- data ----------------------------------------------------------------
+    std::size_t m_width;
+    std::size_t m_height;
+    std::shared_ptr<unsigned char> m_data;
+};
+}  // namespace niu
+
+#endif  // _NIU_PIXEL_IMAGE_H_
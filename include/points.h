@@ -0,0 +1,27 @@
+#ifndef _NIU_POINTS_H_
+#define _NIU_POINTS_H_
+
+#include <string>
+#include <vector>
+
+#include "image.h"
+
+namespace niu {
+// -- points ------------------------------------------------------------------
+// Magic of binary points files, followed by 12-byte records: x and y as
+// big-endian 32-bit integers and the color as R, G, B, A bytes.
+char const points_magic[] = "NIUPTS01";
+
+// Reads positions for Image::set_colors from a text or binary file, which
+// is memory mapped where possible and parsed in parallel. Text lines hold
+// 'X Y' or 'X Y RRGGBB[AA]' (spaces, tabs or commas between); a line with
+// only a color sets it for the following points, which take 'color' before
+// the first such line. '#' starts a comment.
+bool
+read_points(
+        std::string const& file,
+        Color color,
+        std::vector<ColorPoint>& points);
+}  // namespace niu
+
+#endif  // _NIU_POINTS_H_
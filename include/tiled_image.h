@@ -0,0 +1,110 @@
+#ifndef _NIU_TILED_IMAGE_H_
+#define _NIU_TILED_IMAGE_H_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "image.h"
+
+namespace niu {
+// -- TiledImage declaration --------------------------------------------------
+// RGBA canvas stored as tile_size x tile_size tiles, for images too large for
+// a single buffer. A tile that was only filled is kept as its color and gets
+// storage on first write. When the full canvas exceeds the RAM budget, the
+// tiles live in an unlinked scratch file mapped into memory, so the OS pages
+// them out instead of the process running out of memory. Saving streams the
+// rows, so the canvas is never assembled in one piece.
+class TiledImage
+{
+public:
+    static std::size_t const tile_size = 256;
+
+    // -- constructor ---------------------------------------------------------
+    // ram_budget in bytes, 0 - no limit; the scratch file is created in
+    // scratch_dir (TMPDIR or /tmp if empty)
+    TiledImage(
+            std::size_t width,
+            std::size_t height,
+            std::size_t ram_budget = 0,
+            std::string const& scratch_dir = std::string());
+
+    TiledImage(TiledImage const&) = delete;
+
+    TiledImage&
+    operator =(TiledImage const&) = delete;
+
+    ~TiledImage();
+
+    // -- functions -----------------------------------------------------------
+    // reads an image of the same size; PNG files are decoded row by row
+    // straight into the tiles
+    bool
+    load(std::string const& file);
+
+    bool
+    save(std::string const& file,
+            Format format = Format::png,
+            EncodeOptions const& options = EncodeOptions()) const;
+
+    void
+    merge(Image const& image,
+            Point const& offset,
+            BlendMode mode = BlendMode::mask);
+
+    void
+    merge(ImageView const& image,
+            Point const& offset,
+            BlendMode mode = BlendMode::mask);
+
+    // -- modifications -------------------------------------------------------
+    void
+    set_color(
+            std::size_t x,
+            std::size_t y,
+            Color color);
+
+    void
+    fill(Color color);
+
+    // -- data ----------------------------------------------------------------
+    std::size_t
+    width() const noexcept;
+
+    std::size_t
+    height() const noexcept;
+
+    // true if tiles are backed by the scratch file
+    bool
+    is_mapped() const noexcept;
+
+private:
+    // -- Tile ----------------------------------------------------------------
+    struct Tile
+    {
+        // nullptr - every pixel is 'color'
+        unsigned char* data = nullptr;
+        Color color = Color{ };
+    };
+
+    // storage of the tile, filled with its color when first used; keep -
+    // false if the caller overwrites every pixel of the tile anyway
+    unsigned char*
+    tile_data(
+            std::size_t index,
+            bool keep = true);
+
+    // -- data ----------------------------------------------------------------
+    std::size_t m_width;
+    std::size_t m_height;
+    std::size_t m_columns;
+    std::vector<Tile> m_tiles;
+    // storage of RAM backed tiles
+    std::vector<std::shared_ptr<unsigned char> > m_buffers;
+    void* m_map;
+    std::size_t m_map_size;
+};
+}  // namespace niu
+
+#endif  // _NIU_TILED_IMAGE_H_
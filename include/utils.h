@@ -6,13 +6,16 @@
 #else
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <dirent.h>
 
 #include <cstdlib>
 #endif  // C++17+
 
 #include <algorithm>
+#include <cstring>
 #include <functional>
 #include <string>
+#include <vector>
 
 namespace niu {
 namespace utils {
@@ -106,6 +109,99 @@ _make_directory(
 #endif  // C++17+
 }
 
+inline std::vector<std::string>
+_list_directory(
+        std::string const& path)
+{
+    std::vector<std::string> res;
+#if __cplusplus >= 201703L
+    std::error_code ec;
+    for (auto const& entry : std::filesystem::directory_iterator(path, ec)) {
+        if (!entry.is_directory(ec)) {
+            res.push_back(entry.path().filename().string());
+        }
+    }
+#else
+    DIR* dir = opendir(path.c_str());
+    if (dir) {
+        while (dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name != "." && name != ".."
+                    && _is_file_exists(path + "/" + name)) {
+                res.push_back(name);
+            }
+        }
+        closedir(dir);
+    }
+#endif  // C++17+
+    std::sort(res.begin(), res.end());
+    return res;
+}
+
+inline bool
+_has_wildcard(
+        std::string const& str)
+{
+    return str.find_first_of("*?[") != std::string::npos;
+}
+
+inline bool
+_match_wildcard(
+        char const* str,
+        char const* pattern)
+{
+    for (; *pattern; ++pattern) {
+        switch (*pattern) {
+            case '*' :
+                for (char const* s = str; ; ++s) {
+                    if (_match_wildcard(s, pattern + 1)) {
+                        return true;
+                    }
+                    if (!*s) {
+                        return false;
+                    }
+                }
+            case '?' :
+                if (!*str++) {
+                    return false;
+                }
+                break;
+            case '[' :
+                {
+                    char const* end = std::strchr(pattern + 1, ']');
+                    if (!end || !*str) {
+                        if (*str++ != '[') {
+                            return false;
+                        }
+                        break;
+                    }
+                    bool negate = pattern[1] == '!' || pattern[1] == '^';
+                    bool found = false;
+                    for (char const* p = pattern + 1 + negate; p < end; ++p) {
+                        if (p + 2 < end && p[1] == '-') {
+                            found |= (*str >= p[0] && *str <= p[2]);
+                            p += 2;
+                        } else {
+                            found |= (*str == *p);
+                        }
+                    }
+                    if (found == negate) {
+                        return false;
+                    }
+                    ++str;
+                    pattern = end;
+                }
+                break;
+            default :
+                if (*str++ != *pattern) {
+                    return false;
+                }
+                break;
+        }
+    }
+    return !*str;
+}
+
 inline std::string
 _replace(
         std::string str,
@@ -0,0 +1,158 @@
+#include "allocator.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <malloc.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#endif  // _MSC_VER
+
+namespace niu {
+namespace {
+// ----------------------------------------------------------------------------
+std::size_t const huge_page_size = std::size_t(2) << 20;
+
+// pooled bytes kept at most, larger buffers are freed
+std::size_t const pool_limit = std::size_t(256) << 20;
+
+// ----------------------------------------------------------------------------
+inline void*
+aligned_malloc(
+        std::size_t size,
+        std::size_t alignment)
+{
+#if defined(_MSC_VER)
+    return _aligned_malloc(size, alignment);
+#else
+    void* res = nullptr;
+    return posix_memalign(&res, alignment, size) == 0 ? res : nullptr;
+#endif  // _MSC_VER
+}
+
+// ----------------------------------------------------------------------------
+inline void
+aligned_free(
+        void* ptr)
+{
+#if defined(_MSC_VER)
+    _aligned_free(ptr);
+#else
+    std::free(ptr);
+#endif  // _MSC_VER
+}
+
+// -- Pool --------------------------------------------------------------------
+struct Pool
+{
+    std::mutex mutex{ };
+    std::multimap<std::size_t, void*> buffers{ };
+    std::size_t bytes = 0;
+    bool enabled = false;
+};
+
+// ----------------------------------------------------------------------------
+// never destroyed: buffers may be released after static destructors run
+Pool&
+pool()
+{
+    static Pool* res = new Pool();
+    return *res;
+}
+
+// ----------------------------------------------------------------------------
+void
+recycle(void* ptr,
+        std::size_t size)
+{
+    auto& p = pool();
+    {
+        std::lock_guard<std::mutex> lock(p.mutex);
+        if (p.enabled && p.bytes + size <= pool_limit) {
+            p.buffers.insert(std::make_pair(size, ptr));
+            p.bytes += size;
+            return;
+        }
+    }
+    aligned_free(ptr);
+}
+}  // namespace
+
+// ----------------------------------------------------------------------------
+std::shared_ptr<unsigned char>
+allocate_buffer(
+        std::size_t size,
+        bool zero)
+{
+    // one rounded size per pool bucket
+    size = (size + buffer_alignment - 1) / buffer_alignment * buffer_alignment;
+    if (size == 0) {
+        size = buffer_alignment;
+    }
+    void* ptr = nullptr;
+    {
+        auto& p = pool();
+        std::lock_guard<std::mutex> lock(p.mutex);
+        auto const it = p.buffers.find(size);
+        if (it != p.buffers.end()) {
+            ptr = it->second;
+            p.buffers.erase(it);
+            p.bytes -= size;
+        }
+    }
+    if (!ptr) {
+        bool const huge = size >= huge_page_size;
+        ptr = aligned_malloc(size, huge ? huge_page_size : buffer_alignment);
+        if (!ptr) {
+            throw std::bad_alloc();
+        }
+#if defined(MADV_HUGEPAGE)
+        if (huge) {
+            madvise(ptr, size, MADV_HUGEPAGE);
+        }
+#endif  // MADV_HUGEPAGE
+    }
+    if (zero) {
+        std::memset(ptr, 0, size);
+    }
+    return std::shared_ptr<unsigned char>(static_cast<unsigned char*>(ptr),
+                                          [size] (unsigned char* data)
+    {
+        recycle(data, size);
+    });
+}
+
+// ----------------------------------------------------------------------------
+void
+set_buffer_pooling(
+        bool enabled)
+{
+    {
+        auto& p = pool();
+        std::lock_guard<std::mutex> lock(p.mutex);
+        p.enabled = enabled;
+    }
+    if (!enabled) {
+        release_buffers();
+    }
+}
+
+// ----------------------------------------------------------------------------
+void
+release_buffers()
+{
+    auto& p = pool();
+    std::lock_guard<std::mutex> lock(p.mutex);
+    for (auto const& buffer : p.buffers) {
+        aligned_free(buffer.second);
+    }
+    p.buffers.clear();
+    p.bytes = 0;
+}
+}  // namespace niu
@@ -0,0 +1,411 @@
+#include "any_image.h"
+
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wconversion"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#include <stb_image.h>
+#pragma GCC diagnostic pop
+
+#include "decoder.h"
+#include "endian.h"
+#include "io.h"
+#include "pixel_image.h"
+
+namespace niu {
+// -- AnyImage::Holder --------------------------------------------------------
+class AnyImage::Holder
+{
+public:
+    virtual ~Holder() = default;
+
+    // shares the pixels until either one is modified
+    virtual std::shared_ptr<Holder>
+    copy() const = 0;
+
+    virtual std::shared_ptr<Holder>
+    clone() const = 0;
+
+    // every pixel written as an n x n block
+    virtual bool
+    save(std::string const& file,
+            std::size_t n,
+            Format format,
+            EncodeOptions const& options) const = 0;
+
+    virtual void
+    inverse_x() = 0;
+
+    virtual void
+    inverse_y() = 0;
+
+    virtual void
+    upscale(std::size_t n) = 0;
+
+    virtual void
+    set_color(
+            std::size_t x,
+            std::size_t y,
+            Color color) = 0;
+
+    virtual void
+    fill(Color color) = 0;
+
+    virtual PixelType
+    type() const = 0;
+
+    virtual std::size_t
+    width() const = 0;
+
+    virtual std::size_t
+    height() const = 0;
+
+    // start of the pixels, rows without padding
+    virtual unsigned char*
+    data() = 0;
+};
+
+// -- AnyImage::Model ---------------------------------------------------------
+template <class F>
+class AnyImage::Model : public AnyImage::Holder
+{
+public:
+    Model(std::size_t width,
+            std::size_t height,
+            PixelType type)
+        : m_image(BasicImage<F>::make_image(width, height, false)),
+          m_type(type)
+    {
+    }
+
+    std::shared_ptr<Holder>
+    copy() const override
+    {
+        return std::make_shared<Model>(*this);
+    }
+
+    std::shared_ptr<Holder>
+    clone() const override
+    {
+        auto res = std::make_shared<Model>(*this);
+        res->m_image = m_image.clone();
+        return res;
+    }
+
+    bool
+    save(std::string const& file,
+            std::size_t n,
+            Format format,
+            EncodeOptions const& options) const override
+    {
+        BasicImage<F> const& image = m_image;
+        if (n == 0 || image.width() > std::numeric_limits<std::size_t>::max() / n
+                || image.height() > std::numeric_limits<std::size_t>::max() / n) {
+            throw std::overflow_error("integer overflow");
+        }
+        // the enlarged image is never materialized: each source row is
+        // expanded once and handed out n times; PNG samples are big-endian
+        std::size_t const width = image.width();
+        std::size_t const size = width * F::pixel_size * n;
+        bool const direct = F::bit_depth == 8 && n == 1;
+        std::vector<uint16_t> buffer(direct ? 0 : (size + 1) / 2);
+        RowProducer producer = [&] (std::size_t y, unsigned char*) -> unsigned char const*
+        {
+            unsigned char const* from = image.row(y / n);
+            if (direct) {
+                return from;
+            }
+            unsigned char* to = reinterpret_cast<unsigned char*>(buffer.data());
+            if (y % n == 0) {
+                for (std::size_t x = 0; x < width; ++x, from += F::pixel_size) {
+                    for (std::size_t k = 0; k < n; ++k, to += F::pixel_size) {
+                        std::memcpy(to, from, F::pixel_size);
+                    }
+                }
+                if (F::bit_depth == 16) {
+                    for (auto& sample : buffer) {
+                        sample = htons(sample);
+                    }
+                }
+            }
+            return reinterpret_cast<unsigned char const*>(buffer.data());
+        };
+        if (F::bit_depth == 8 && F::channels == Image::channels) {
+            // RGBA keeps palette and parallel encoding options
+            return Image::save_rows(file, width * n, image.height() * n,
+                                    producer, format, options);
+        }
+        return Image::save_rows(file, width * n, image.height() * n, F::channels,
+                                F::bit_depth, producer, format, options);
+    }
+
+    void
+    inverse_x() override
+    {
+        m_image.inverse_x();
+    }
+
+    void
+    inverse_y() override
+    {
+        m_image.inverse_y();
+    }
+
+    void
+    upscale(std::size_t n) override
+    {
+        m_image.upscale(n);
+    }
+
+    void
+    set_color(
+            std::size_t x,
+            std::size_t y,
+            Color color) override
+    {
+        m_image.set_color(x, y, to_pixel<F>(color));
+    }
+
+    void
+    fill(Color color) override
+    {
+        m_image.fill(to_pixel<F>(color));
+    }
+
+    PixelType
+    type() const override
+    {
+        return m_type;
+    }
+
+    std::size_t
+    width() const override
+    {
+        return m_image.width();
+    }
+
+    std::size_t
+    height() const override
+    {
+        return m_image.height();
+    }
+
+    unsigned char*
+    data() override
+    {
+        return m_image.row(0);
+    }
+
+private:
+    BasicImage<F> m_image;
+    PixelType m_type;
+};
+
+// -- AnyImage implementation -------------------------------------------------
+AnyImage::AnyImage()
+    : m_image()
+{
+}
+
+// ----------------------------------------------------------------------------
+AnyImage
+AnyImage::clone() const
+{
+    AnyImage res;
+    if (m_image) {
+        res.m_image = m_image->clone();
+    }
+    return res;
+}
+
+// ----------------------------------------------------------------------------
+AnyImage::Holder&
+AnyImage::detach()
+{
+    if (!m_image) {
+        throw std::invalid_argument("invalid image parameters");
+    }
+    if (m_image.use_count() != 1) {
+        m_image = m_image->copy();
+    }
+    return *m_image;
+}
+
+// ----------------------------------------------------------------------------
+bool
+AnyImage::load(
+        std::string const& file)
+{
+    auto const make = [] (std::size_t width, std::size_t height,
+                          std::size_t channels, std::size_t bit_depth)
+    {
+        std::shared_ptr<Holder> res;
+        switch ((bit_depth == 16 ? 4 : 0) + channels) {
+            case 1 :
+                res = std::make_shared<Model<Gray8> >(width, height, PixelType::gray8);
+                break;
+            case 2 :
+                res = std::make_shared<Model<GrayAlpha8> >(width, height,
+                                                           PixelType::gray_alpha8);
+                break;
+            case 3 :
+                res = std::make_shared<Model<Rgb8> >(width, height, PixelType::rgb8);
+                break;
+            case 4 :
+                res = std::make_shared<Model<Rgba8> >(width, height, PixelType::rgba8);
+                break;
+            case 5 :
+                res = std::make_shared<Model<Gray16> >(width, height, PixelType::gray16);
+                break;
+            case 6 :
+                res = std::make_shared<Model<GrayAlpha16> >(width, height,
+                                                            PixelType::gray_alpha16);
+                break;
+            case 7 :
+                res = std::make_shared<Model<Rgb16> >(width, height, PixelType::rgb16);
+                break;
+            case 8 :
+                res = std::make_shared<Model<Rgba16> >(width, height, PixelType::rgba16);
+                break;
+            default :
+                throw std::invalid_argument("unsupported pixel format");
+        }
+        return res;
+    };
+
+    std::shared_ptr<Holder> res;
+    MappedFile mapped;
+    if (!mapped.open(file)) {
+        std::cerr << "Failed to load image: " << file << std::endl;
+        return false;
+    }
+    static unsigned char const signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    if (mapped.size() >= sizeof(signature)
+            && std::memcmp(mapped.data(), signature, sizeof(signature)) == 0) {
+        mapped.close();
+        if (!read_png_raw(file, [&] (std::size_t width, std::size_t height,
+                                     std::size_t channels, std::size_t bit_depth)
+        {
+            res = make(width, height, channels, bit_depth);
+            return res->data();
+        })) {
+            return false;
+        }
+    } else {
+        // other formats as stb_image decodes them, 8-bit
+        int w, h, ch;
+        if (mapped.size() > static_cast<std::size_t>(std::numeric_limits<int>::max())) {
+            std::cerr << "Failed to load image: " << file << std::endl;
+            return false;
+        }
+        std::unique_ptr<unsigned char, void(*)(void*)> data(
+                    stbi_load_from_memory(mapped.data(), static_cast<int>(mapped.size()),
+                                          &w, &h, &ch, 0), stbi_image_free);
+        if (!data) {
+            std::cerr << "Failed to load image: " << file << std::endl;
+            return false;
+        }
+        auto const channels = static_cast<std::size_t>(ch);
+        res = make(static_cast<std::size_t>(w), static_cast<std::size_t>(h), channels, 8);
+        std::memcpy(res->data(), data.get(), res->width() * res->height() * channels);
+    }
+    m_image = res;
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+bool
+AnyImage::save(
+        std::string const& file,
+        Format format,
+        EncodeOptions const& options) const
+{
+    return m_image && m_image->save(file, 1, format, options);
+}
+
+// ----------------------------------------------------------------------------
+bool
+AnyImage::save_upscaled(
+        std::string const& file,
+        std::size_t n,
+        Format format,
+        EncodeOptions const& options) const
+{
+    return m_image && m_image->save(file, n, format, options);
+}
+
+// ----------------------------------------------------------------------------
+void
+AnyImage::inverse_x()
+{
+    if (m_image) {
+        detach().inverse_x();
+    }
+}
+
+// ----------------------------------------------------------------------------
+void
+AnyImage::inverse_y()
+{
+    if (m_image) {
+        detach().inverse_y();
+    }
+}
+
+// ----------------------------------------------------------------------------
+void
+AnyImage::upscale(
+        std::size_t n)
+{
+    if (m_image) {
+        detach().upscale(n);
+    }
+}
+
+// ----------------------------------------------------------------------------
+void
+AnyImage::set_color(
+        std::size_t x,
+        std::size_t y,
+        Color color)
+{
+    detach().set_color(x, y, color);
+}
+
+// ----------------------------------------------------------------------------
+void
+AnyImage::fill(
+        Color color)
+{
+    if (m_image) {
+        detach().fill(color);
+    }
+}
+
+// ----------------------------------------------------------------------------
+PixelType
+AnyImage::type() const
+{
+    return m_image ? m_image->type() : PixelType::rgba8;
+}
+
+// ----------------------------------------------------------------------------
+std::size_t
+AnyImage::width() const
+{
+    return m_image ? m_image->width() : 0;
+}
+
+// ----------------------------------------------------------------------------
+std::size_t
+AnyImage::height() const
+{
+    return m_image ? m_image->height() : 0;
+}
+}  // namespace niu
@@ -0,0 +1,292 @@
+#include "atlas.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+
+#include "parallel.h"
+
+namespace niu {
+namespace {
+// ----------------------------------------------------------------------------
+struct Rect
+{
+    std::size_t x;
+    std::size_t y;
+    std::size_t w;
+    std::size_t h;
+};
+
+// ----------------------------------------------------------------------------
+inline bool
+contains(
+        Rect const& a,
+        Rect const& b)
+{
+    return b.x >= a.x && b.y >= a.y && b.x + b.w <= a.x + a.w && b.y + b.h <= a.y + a.h;
+}
+
+// ----------------------------------------------------------------------------
+inline bool
+intersects(
+        Rect const& a,
+        Rect const& b)
+{
+    return a.x < b.x + b.w && b.x < a.x + a.w && a.y < b.y + b.h && b.y < a.y + a.h;
+}
+
+// ----------------------------------------------------------------------------
+std::size_t
+next_power_of_two(std::size_t value)
+{
+    std::size_t res = 1;
+    while (res < value) {
+        res *= 2;
+    }
+    return res;
+}
+
+// ----------------------------------------------------------------------------
+// Free space of the bin as maximal rectangles
+class MaxRects
+{
+public:
+    MaxRects(
+            std::size_t width,
+            std::size_t height)
+        : m_free(1, Rect{ 0, 0, width, height })
+    {
+    }
+
+    // bottom-left rule: the lowest bottom edge, then the leftmost position
+    bool
+    insert(std::size_t w,
+            std::size_t h,
+            Rect& res)
+    {
+        std::size_t best = m_free.size();
+        for (std::size_t i = 0; i < m_free.size(); ++i) {
+            auto const& free = m_free.at(i);
+            if (free.w < w || free.h < h) {
+                continue;
+            }
+            if (best == m_free.size()
+                    || free.y < m_free.at(best).y
+                    || (free.y == m_free.at(best).y && free.x < m_free.at(best).x)) {
+                best = i;
+            }
+        }
+        if (best == m_free.size()) {
+            return false;
+        }
+        res = Rect{ m_free.at(best).x, m_free.at(best).y, w, h };
+        prune(split(res));
+        return true;
+    }
+
+private:
+    // replaces every free rectangle overlapped by 'used' with the up to four
+    // maximal rectangles left around it, which are returned instead of
+    // being added to the free list
+    std::vector<Rect>
+    split(Rect const& used)
+    {
+        std::vector<Rect> res;
+        std::size_t n = 0;
+        for (std::size_t i = 0; i < m_free.size(); ++i) {
+            auto const free = m_free.at(i);
+            if (!intersects(free, used)) {
+                m_free.at(n++) = free;
+                continue;
+            }
+            if (used.x > free.x) {
+                res.push_back(Rect{ free.x, free.y, used.x - free.x, free.h });
+            }
+            if (used.x + used.w < free.x + free.w) {
+                res.push_back(Rect{ used.x + used.w, free.y,
+                                    free.x + free.w - used.x - used.w, free.h });
+            }
+            if (used.y > free.y) {
+                res.push_back(Rect{ free.x, free.y, free.w, used.y - free.y });
+            }
+            if (used.y + used.h < free.y + free.h) {
+                res.push_back(Rect{ free.x, used.y + used.h,
+                                    free.w, free.y + free.h - used.y - used.h });
+            }
+        }
+        m_free.resize(n);
+        return res;
+    }
+
+    // adds the rectangles made by split, dropping free rectangles that lie
+    // inside other ones; the free list holds none of those already, so only
+    // pairs with a new rectangle are compared
+    void
+    prune(std::vector<Rect> const& fresh)
+    {
+        std::vector<char> removed(fresh.size(), 0);
+        for (std::size_t i = 0; i < fresh.size(); ++i) {
+            for (std::size_t j = i + 1; j < fresh.size() && !removed.at(i); ++j) {
+                if (removed.at(j)) {
+                    continue;
+                }
+                if (contains(fresh.at(j), fresh.at(i))) {
+                    removed.at(i) = 1;
+                } else if (contains(fresh.at(i), fresh.at(j))) {
+                    removed.at(j) = 1;
+                }
+            }
+            for (std::size_t j = 0; j < m_free.size() && !removed.at(i); ++j) {
+                if (contains(m_free.at(j), fresh.at(i))) {
+                    removed.at(i) = 1;
+                }
+            }
+        }
+        std::size_t n = 0;
+        for (std::size_t i = 0; i < m_free.size(); ++i) {
+            bool inside = false;
+            for (std::size_t j = 0; j < fresh.size() && !inside; ++j) {
+                inside = !removed.at(j) && contains(fresh.at(j), m_free.at(i));
+            }
+            if (!inside) {
+                m_free.at(n++) = m_free.at(i);
+            }
+        }
+        m_free.resize(n);
+        for (std::size_t i = 0; i < fresh.size(); ++i) {
+            if (!removed.at(i)) {
+                m_free.push_back(fresh.at(i));
+            }
+        }
+    }
+
+    // -- data ----------------------------------------------------------------
+    std::vector<Rect> m_free;
+};
+}  // namespace
+
+// -- atlas -------------------------------------------------------------------
+Vector2
+pack_rects(
+        std::vector<Vector2> const& sizes,
+        std::size_t width,
+        std::size_t padding,
+        std::vector<Vector2>& positions)
+{
+    // every rectangle reserves padding to its right and bottom
+    std::size_t max_width = 0;
+    std::size_t area = 0;
+    std::size_t height = 0;
+    for (auto const& size : sizes) {
+        max_width = std::max(max_width, size.w + padding);
+        area += (size.w + padding) * (size.h + padding);
+        height += size.h + padding;
+    }
+    if (width == 0) {
+        auto const side = static_cast<std::size_t>(
+                    std::ceil(std::sqrt(static_cast<double>(area))));
+        width = next_power_of_two(std::max(max_width, side));
+    } else if (max_width > width + padding) {
+        throw std::invalid_argument("sprite is wider than atlas");
+    }
+
+    // tallest first, the bin grows downwards
+    std::vector<std::size_t> order(sizes.size());
+    std::iota(order.begin(), order.end(), std::size_t(0));
+    std::stable_sort(order.begin(), order.end(), [&sizes] (std::size_t a, std::size_t b)
+    {
+        return sizes.at(a).h != sizes.at(b).h ? sizes.at(a).h > sizes.at(b).h
+                                              : sizes.at(a).w > sizes.at(b).w;
+    });
+
+    // the last column may drop its padding
+    MaxRects bin(width + padding, height);
+    positions.assign(sizes.size(), Vector2{ });
+    Vector2 res;
+    res.w = width;
+    res.h = 0;
+    for (auto const i : order) {
+        auto const& size = sizes.at(i);
+        Rect rect;
+        if (!bin.insert(size.w + padding, size.h + padding, rect)) {
+            throw std::invalid_argument("sprite is wider than atlas");
+        }
+        positions.at(i).x = rect.x;
+        positions.at(i).y = rect.y;
+        res.h = std::max(res.h, rect.y + size.h);
+    }
+    return res;
+}
+
+// ----------------------------------------------------------------------------
+Image
+make_atlas(
+        std::vector<Image> const& sprites,
+        std::size_t width,
+        std::size_t padding,
+        std::vector<Vector2>& positions)
+{
+    std::vector<Vector2> sizes(sprites.size());
+    for (std::size_t i = 0; i < sprites.size(); ++i) {
+        sizes.at(i).w = sprites.at(i).width();
+        sizes.at(i).h = sprites.at(i).height();
+    }
+    auto const size = pack_rects(sizes, width, padding, positions);
+    Image res = Image::make_image(size.w, size.h);
+    for (std::size_t i = 0; i < sprites.size(); ++i) {
+        Point offset;
+        offset.x = static_cast<std::ptrdiff_t>(positions.at(i).x);
+        offset.y = static_cast<std::ptrdiff_t>(positions.at(i).y);
+        res.merge(sprites.at(i), offset, BlendMode::copy);
+    }
+    return res;
+}
+
+// ----------------------------------------------------------------------------
+Image
+render_tilemap(
+        std::vector<std::string> const& rows,
+        std::map<char, Image> const& sprites)
+{
+    Vector2 tile;
+    tile.w = 0;
+    tile.h = 0;
+    for (auto const& sprite : sprites) {
+        tile.w = std::max(tile.w, sprite.second.width());
+        tile.h = std::max(tile.h, sprite.second.height());
+    }
+    std::size_t columns = 0;
+    for (auto const& row : rows) {
+        for (auto const symbol : row) {
+            if (symbol != ' ' && sprites.find(symbol) == sprites.end()) {
+                throw std::invalid_argument(std::string("unknown symbol '") + symbol + "'");
+            }
+        }
+        columns = std::max(columns, row.size());
+    }
+    Image res = Image::make_image(columns * tile.w, rows.size() * tile.h);
+    // the canvas gets its own buffer once, then every band copies sprites
+    // into its own rows
+    unsigned char* data = res.data();
+    std::size_t const stride = res.width() * Image::channels;
+    parallel_bands(rows.size(), [&] (std::size_t begin, std::size_t end)
+    {
+        for (std::size_t y = begin; y < end; ++y) {
+            auto const& row = rows.at(y);
+            for (std::size_t x = 0; x < row.size(); ++x) {
+                if (row.at(x) == ' ') {
+                    continue;
+                }
+                auto const sprite = sprites.at(row.at(x)).view();
+                unsigned char* dst = data + y * tile.h * stride + x * tile.w * Image::channels;
+                for (std::size_t sy = 0; sy < sprite.height(); ++sy, dst += stride) {
+                    std::memcpy(dst, sprite.row(sy), sprite.width() * Image::channels);
+                }
+            }
+        }
+    });
+    return res;
+}
+}  // namespace niu
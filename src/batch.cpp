@@ -0,0 +1,181 @@
+#include "batch.h"
+
+#include <fstream>
+#include <iostream>
+#include <mutex>
+
+#include "allocator.h"
+#include "parallel.h"
+#include "utils.h"
+
+namespace niu {
+namespace {
+// ----------------------------------------------------------------------------
+inline bool
+is_image_file(
+        std::string const& file)
+{
+    static char const* const extensions[] = {
+        ".png", ".jpg", ".jpeg", ".bmp", ".tga", ".gif", ".psd", ".pnm",
+        ".ppm", ".pgm", ".hdr", ".pic",
+    };
+    auto const name = utils::_to_lower(file);
+    for (auto const ext : extensions) {
+        if (utils::_ends_with(name, ext)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// ----------------------------------------------------------------------------
+inline std::string
+join_path(
+        std::string const& dir,
+        std::string const& file)
+{
+    if (dir.empty() || dir == ".") {
+        return file;
+    }
+    if (utils::_ends_with(dir, "/") || utils::_ends_with(dir, "\\")) {
+        return dir + file;
+    }
+    return dir + "/" + file;
+}
+
+// ----------------------------------------------------------------------------
+inline std::string
+replace_all(
+        std::string str,
+        std::string const& old,
+        std::string const& value)
+{
+    auto pos = str.find(old);
+    while (pos != std::string::npos) {
+        str.replace(pos, old.size(), value);
+        pos = str.find(old, pos + value.size());
+    }
+    return str;
+}
+
+// ----------------------------------------------------------------------------
+inline std::string
+trim(
+        std::string const& str)
+{
+    auto const begin = str.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos) {
+        return std::string();
+    }
+    auto const end = str.find_last_not_of(" \t\r\n");
+    return str.substr(begin, end - begin + 1);
+}
+}  // namespace
+
+// ----------------------------------------------------------------------------
+bool
+is_batch_input(
+        std::string const& input)
+{
+    return utils::_is_directory_exists(input) || utils::_has_wildcard(input);
+}
+
+// ----------------------------------------------------------------------------
+std::vector<std::string>
+expand_input(
+        std::string const& input)
+{
+    std::vector<std::string> res;
+    if (utils::_is_directory_exists(input)) {
+        for (auto const& file : utils::_list_directory(input)) {
+            if (is_image_file(file)) {
+                res.push_back(join_path(input, file));
+            }
+        }
+    } else if (utils::_has_wildcard(input)) {
+        auto const dir = utils::_directory_name(input);
+        auto const pattern = utils::_file_name(input);
+        for (auto const& file : utils::_list_directory(dir.empty() ? "." : dir)) {
+            if (utils::_match_wildcard(file.c_str(), pattern.c_str())) {
+                res.push_back(join_path(dir, file));
+            }
+        }
+    } else {
+        res.push_back(input);
+    }
+    return res;
+}
+
+// ----------------------------------------------------------------------------
+bool
+read_input_list(
+        std::string const& file,
+        std::vector<std::string>& inputs)
+{
+    std::ifstream in(file);
+    if (!in.is_open()) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        line = trim(line);
+        if (line.empty() || line.front() == '#') {
+            continue;
+        }
+        inputs.push_back(line);
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+std::string
+make_output_path(
+        std::string const& output,
+        std::string const& input,
+        std::string const& ext)
+{
+    auto const file = utils::_file_name(input);
+    auto const name = file.substr(0, file.find_last_of("."));
+    if (output.find('{') == std::string::npos) {
+        return join_path(output, name + ext);
+    }
+    // files of the current directory have no directory name
+    auto const dir = utils::_directory_name(input);
+    auto res = replace_all(output, "{dir}", dir.empty() ? "." : dir);
+    res = replace_all(res, "{file}", file);
+    return replace_all(res, "{name}", name);
+}
+
+// ----------------------------------------------------------------------------
+BatchResult
+run_batch(
+        std::vector<std::string> const& inputs,
+        std::size_t jobs,
+        std::function<bool(std::string const&, std::string&)> const& task)
+{
+    BatchResult res = { 0, 0 };
+    std::mutex mutex;
+    // the pool only pays off between files of one batch
+    set_buffer_pooling(true);
+    parallel_for(inputs.size(), jobs, [&] (std::size_t i)
+    {
+        std::string message;
+        bool ok = false;
+        try {
+            ok = task(inputs.at(i), message);
+        } catch (std::exception const& e) {
+            message = "[FAIL] File '" + inputs.at(i) + "': " + e.what();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (ok) {
+            ++res.succeeded;
+            std::cout << message << std::endl;
+        } else {
+            ++res.failed;
+            std::cerr << message << std::endl;
+        }
+    });
+    set_buffer_pooling(false);
+    return res;
+}
+}  // namespace niu
@@ -0,0 +1,183 @@
+#include "decoder.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <png.h>
+
+#include "endian.h"
+#include "image.h"
+#include "io.h"
+
+namespace niu {
+namespace {
+// ----------------------------------------------------------------------------
+struct Reader
+{
+    unsigned char const* data;
+    std::size_t size;
+    std::size_t offset;
+};
+
+// ----------------------------------------------------------------------------
+void
+read_data(
+        png_structp png_ptr,
+        png_bytep data,
+        png_size_t size)
+{
+    auto& reader = *static_cast<Reader*>(png_get_io_ptr(png_ptr));
+    if (size > reader.size - reader.offset) {
+        png_error(png_ptr, "unexpected end of file");
+    }
+    std::memcpy(data, reader.data + reader.offset, size);
+    reader.offset += size;
+}
+
+// ----------------------------------------------------------------------------
+// native - keep channels and 16-bit samples (host byte order), otherwise
+// convert to 8-bit RGBA; rows go to 'consume' if it is set, to storage from
+// 'allocate' otherwise
+bool
+decode(std::string const& file,
+        PngRegion const& region,
+        bool native,
+        RawAllocator const& allocate,
+        RowConsumer const& consume = RowConsumer())
+{
+    MappedFile mapped;
+    if (!mapped.open(file)) {
+        std::cerr << "Failed to open image: " << file << std::endl;
+        return false;
+    }
+    Reader reader = { mapped.data(), mapped.size(), 0 };
+
+    png_structp png_ptr = png_create_read_struct(
+                PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    if (!png_ptr) {
+        return false;
+    }
+    png_infop png_info = png_create_info_struct(png_ptr);
+    std::vector<unsigned char> rows;
+    if (!png_info || setjmp(png_jmpbuf(png_ptr))) {
+        png_destroy_read_struct(&png_ptr, &png_info, nullptr);
+        std::cerr << "Failed to decode image: " << file << std::endl;
+        return false;
+    }
+
+    png_set_read_fn(png_ptr, &reader, read_data);
+    png_read_info(png_ptr, png_info);
+
+    // palette, low bit gray and tRNS are always expanded
+    auto const color_type = png_get_color_type(png_ptr, png_info);
+    png_set_expand(png_ptr);
+    if (native) {
+        if (png_get_bit_depth(png_ptr, png_info) == 16 && is_little_endian()) {
+            png_set_swap(png_ptr);
+        }
+    } else {
+        // any PNG to 8-bit RGBA
+        png_set_strip_16(png_ptr);
+        if (color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA) {
+            png_set_gray_to_rgb(png_ptr);
+        }
+        if (!(color_type & PNG_COLOR_MASK_ALPHA)
+                && !png_get_valid(png_ptr, png_info, PNG_INFO_tRNS)) {
+            png_set_add_alpha(png_ptr, 0xff, PNG_FILLER_AFTER);
+        }
+    }
+    int const passes = png_set_interlace_handling(png_ptr);
+    png_read_update_info(png_ptr, png_info);
+
+    std::size_t const width = png_get_image_width(png_ptr, png_info);
+    std::size_t const height = png_get_image_height(png_ptr, png_info);
+    std::size_t const row_size = png_get_rowbytes(png_ptr, png_info);
+    std::size_t const channels = png_get_channels(png_ptr, png_info);
+    std::size_t const bit_depth = png_get_bit_depth(png_ptr, png_info);
+    std::size_t const pixel_size = channels * bit_depth / 8;
+    std::size_t const w = region.width != 0 ? region.width : width - std::min(width, region.x);
+    std::size_t const h = region.height != 0 ? region.height : height - std::min(height, region.y);
+    if (row_size != width * pixel_size || w == 0 || h == 0
+            || region.x > width || w > width - region.x
+            || region.y > height || h > height - region.y) {
+        png_destroy_read_struct(&png_ptr, &png_info, nullptr);
+        std::cerr << "Invalid region of image: " << file << std::endl;
+        return false;
+    }
+
+    try {
+        unsigned char* dst = consume ? nullptr : allocate(w, h, channels, bit_depth);
+        std::size_t const offset = region.x * pixel_size;
+        std::size_t const size = w * pixel_size;
+        // full-width rows of a non-interlaced image are decoded straight
+        // into the destination
+        bool const direct = !consume && passes == 1 && offset == 0 && size == row_size;
+        // interlaced rows are completed by later passes, so all region rows
+        // stay resident; otherwise a single row is reused
+        rows.resize(passes > 1 ? (h + 1) * row_size : row_size);
+        unsigned char* scratch = rows.data() + rows.size() - row_size;
+        for (int pass = 0; pass < passes; ++pass) {
+            std::size_t const last = pass + 1 == passes ? region.y + h : height;
+            for (std::size_t y = 0; y < last; ++y) {
+                bool const inside = y >= region.y && y < region.y + h;
+                unsigned char* row = scratch;
+                if (inside && direct) {
+                    row = dst + (y - region.y) * size;
+                } else if (inside && passes > 1) {
+                    row = rows.data() + (y - region.y) * row_size;
+                }
+                png_read_row(png_ptr, row, nullptr);
+                if (!inside || pass + 1 != passes || direct) {
+                    continue;
+                }
+                if (consume) {
+                    consume(y - region.y, row + offset);
+                } else {
+                    std::memcpy(dst + (y - region.y) * size, row + offset, size);
+                }
+            }
+        }
+    } catch (...) {
+        png_destroy_read_struct(&png_ptr, &png_info, nullptr);
+        throw;
+    }
+    // rows after the region are never read
+    png_destroy_read_struct(&png_ptr, &png_info, nullptr);
+    return true;
+}
+}  // namespace
+
+// -- decoder -----------------------------------------------------------------
+bool
+read_png(
+        std::string const& file,
+        PngRegion const& region,
+        PixelAllocator const& allocate)
+{
+    return decode(file, region, false, [&allocate] (std::size_t width, std::size_t height,
+                                                    std::size_t, std::size_t)
+    {
+        return allocate(width, height);
+    });
+}
+
+// ----------------------------------------------------------------------------
+bool
+read_png_raw(
+        std::string const& file,
+        RawAllocator const& allocate)
+{
+    return decode(file, PngRegion(), true, allocate);
+}
+
+// ----------------------------------------------------------------------------
+bool
+read_png_rows(
+        std::string const& file,
+        RowConsumer const& consume)
+{
+    return decode(file, PngRegion(), false, RawAllocator(), consume);
+}
+}  // namespace niu
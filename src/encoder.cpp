@@ -0,0 +1,644 @@
+#include "encoder.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <png.h>
+#include <zlib.h>
+
+#include "io.h"
+#include "parallel.h"
+
+namespace niu {
+namespace {
+// ----------------------------------------------------------------------------
+std::size_t const stripe_size = 128 * 1024;
+std::size_t const window_size = 32 * 1024;
+std::size_t const palette_size = 256;
+// zlib counts bytes in uInt, larger buffers are passed in pieces
+std::size_t const zlib_piece = std::numeric_limits<uInt>::max();
+// PNG chunk data is limited to 2^31 - 1 bytes
+std::size_t const max_chunk_size = 0x7fffffff;
+
+// ----------------------------------------------------------------------------
+struct Layout
+{
+    int color_type = PNG_COLOR_TYPE_RGBA;
+    int bit_depth = 8;
+    // distance in bytes between the bytes compared by the row filters
+    std::size_t bpp = Image::channels;
+    std::size_t row_size = 0;
+    // size of the rows the producer fills
+    std::size_t buffer_size = 0;
+    std::vector<png_color> palette = std::vector<png_color>();
+    std::vector<png_byte> transparency = std::vector<png_byte>();
+    std::unordered_map<uint32_t, unsigned char> index
+            = std::unordered_map<uint32_t, unsigned char>();
+};
+
+// ----------------------------------------------------------------------------
+struct Stripe
+{
+    std::size_t rows = 0;
+    std::vector<unsigned char> raw = std::vector<unsigned char>();
+    std::vector<unsigned char> filtered = std::vector<unsigned char>();
+    std::vector<unsigned char> compressed = std::vector<unsigned char>();
+    uLong adler = 0;
+};
+
+// ----------------------------------------------------------------------------
+inline void
+put_uint32(
+        unsigned char* data,
+        uint32_t value)
+{
+    data[0] = static_cast<unsigned char>(value >> 24);
+    data[1] = static_cast<unsigned char>(value >> 16);
+    data[2] = static_cast<unsigned char>(value >> 8);
+    data[3] = static_cast<unsigned char>(value);
+}
+
+// ----------------------------------------------------------------------------
+inline bool
+write_chunk(
+        OutputFile& f,
+        char const* type,
+        unsigned char const* data,
+        std::size_t size)
+{
+    unsigned char header[8];
+    put_uint32(header, static_cast<uint32_t>(size));
+    std::memcpy(header + 4, type, 4);
+    uLong crc = crc32(0L, header + 4, 4);
+    for (std::size_t pos = 0; pos < size; pos += zlib_piece) {
+        crc = crc32(crc, data + pos, static_cast<uInt>(std::min(size - pos, zlib_piece)));
+    }
+    unsigned char trailer[4];
+    put_uint32(trailer, static_cast<uint32_t>(crc));
+    return f.write(header, sizeof(header))
+            && (size == 0 || f.write(data, size))
+            && f.write(trailer, sizeof(trailer));
+}
+
+// ----------------------------------------------------------------------------
+void
+write_data(
+        png_structp png_ptr,
+        png_bytep data,
+        png_size_t size)
+{
+    auto& f = *static_cast<OutputFile*>(png_get_io_ptr(png_ptr));
+    if (!f.write(data, size)) {
+        png_error(png_ptr, "write error");
+    }
+}
+
+// ----------------------------------------------------------------------------
+// the file is flushed once, on close
+void
+flush_data(
+        png_structp)
+{
+}
+
+// ----------------------------------------------------------------------------
+inline unsigned char
+paeth(unsigned char a,
+        unsigned char b,
+        unsigned char c)
+{
+    int const p = a + b - c;
+    int const pa = std::abs(p - a);
+    int const pb = std::abs(p - b);
+    int const pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return a;
+    }
+    return pb <= pc ? b : c;
+}
+
+// ----------------------------------------------------------------------------
+inline int
+zlib_strategy(
+        EncodeOptions const& options)
+{
+    switch (options.strategy) {
+        case Strategy::standard :
+            return Z_DEFAULT_STRATEGY;
+        case Strategy::filtered :
+            return Z_FILTERED;
+        case Strategy::huffman :
+            return Z_HUFFMAN_ONLY;
+        case Strategy::rle :
+            return Z_RLE;
+        case Strategy::fixed :
+            return Z_FIXED;
+        default :
+            return options.filter == RowFilter::none ? Z_DEFAULT_STRATEGY
+                                                     : Z_FILTERED;
+    }
+}
+
+// ----------------------------------------------------------------------------
+inline int
+png_filters(
+        RowFilter filter)
+{
+    switch (filter) {
+        case RowFilter::none :
+            return PNG_FILTER_NONE;
+        case RowFilter::sub :
+            return PNG_FILTER_SUB;
+        case RowFilter::up :
+            return PNG_FILTER_UP;
+        case RowFilter::average :
+            return PNG_FILTER_AVG;
+        case RowFilter::paeth :
+            return PNG_FILTER_PAETH;
+        default :
+            return PNG_ALL_FILTERS;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Filters one scanline into 'out' (filter byte + size bytes). The adaptive
+// filter picks the type with the minimum sum of absolute differences like
+// libpng does.
+inline void
+filter_row(
+        unsigned char const* row,
+        unsigned char const* prev,
+        std::size_t size,
+        unsigned char* out,
+        unsigned char* scratch,
+        std::size_t bpp,
+        RowFilter filter)
+{
+    std::size_t best_sum = std::numeric_limits<std::size_t>::max();
+    unsigned char best = 0;
+    for (unsigned char type = 0; type < 5; ++type) {
+        if (filter != RowFilter::adaptive
+                && type != static_cast<unsigned char>(filter) - 1) {
+            continue;
+        }
+        if (filter == RowFilter::adaptive
+                && prev == nullptr && (type == 2 || type == 4)) {
+            // with no previous row Up equals None and Paeth equals Sub
+            continue;
+        }
+        unsigned char* dst = scratch + type * size;
+        std::size_t sum = 0;
+        for (std::size_t i = 0; i < size; ++i) {
+            unsigned char const a = i >= bpp ? row[i - bpp] : 0;
+            unsigned char const b = prev ? prev[i] : 0;
+            unsigned char const c = prev && i >= bpp ? prev[i - bpp] : 0;
+            unsigned char predictor = 0;
+            switch (type) {
+                case 1 :
+                    predictor = a;
+                    break;
+                case 2 :
+                    predictor = b;
+                    break;
+                case 3 :
+                    predictor = static_cast<unsigned char>((a + b) / 2);
+                    break;
+                case 4 :
+                    predictor = paeth(a, b, c);
+                    break;
+                default :
+                    break;
+            }
+            dst[i] = static_cast<unsigned char>(row[i] - predictor);
+            sum += dst[i] < 128 ? dst[i] : 256u - dst[i];
+        }
+        if (filter != RowFilter::adaptive) {
+            best = type;
+            break;
+        }
+        if (sum < best_sum) {
+            best_sum = sum;
+            best = type;
+        }
+    }
+    out[0] = best;
+    std::memcpy(out + 1, scratch + best * size, size);
+}
+
+// ----------------------------------------------------------------------------
+// Collects the distinct colors of the image, gives up once there are more
+// than a palette can hold. Translucent entries go first so that the tRNS
+// chunk only covers them.
+inline bool
+make_palette(
+        std::size_t width,
+        std::size_t height,
+        RowProducer const& producer,
+        Layout& layout)
+{
+    std::vector<unsigned char> buffer(width * Image::channels);
+    std::vector<uint32_t> colors;
+    std::unordered_map<uint32_t, unsigned char> index;
+    index.reserve(palette_size * 2);
+    for (std::size_t y = 0; y < height; ++y) {
+        unsigned char const* row = producer(y, buffer.data());
+        uint32_t last = 0;
+        for (std::size_t x = 0; x < width; ++x, row += Image::channels) {
+            uint32_t color;
+            std::memcpy(&color, row, sizeof(color));
+            if ((x != 0 && color == last) || index.count(color) != 0) {
+                last = color;
+                continue;
+            }
+            if (colors.size() == palette_size) {
+                return false;
+            }
+            index.emplace(color, static_cast<unsigned char>(colors.size()));
+            colors.push_back(color);
+            last = color;
+        }
+    }
+    std::stable_partition(colors.begin(), colors.end(), [] (uint32_t color)
+    {
+        return reinterpret_cast<unsigned char const*>(&color)[3] != 0xff;
+    });
+    for (std::size_t i = 0; i < colors.size(); ++i) {
+        unsigned char const* rgba = reinterpret_cast<unsigned char const*>(&colors.at(i));
+        layout.palette.push_back(png_color{ rgba[0], rgba[1], rgba[2] });
+        if (rgba[3] != 0xff) {
+            layout.transparency.push_back(rgba[3]);
+        }
+        layout.index[colors.at(i)] = static_cast<unsigned char>(i);
+    }
+    layout.color_type = PNG_COLOR_TYPE_PALETTE;
+    layout.bit_depth = colors.size() <= 2 ? 1 : colors.size() <= 4 ? 2
+                                              : colors.size() <= 16 ? 4 : 8;
+    layout.bpp = 1;
+    layout.row_size = (width * static_cast<std::size_t>(layout.bit_depth) + 7) / 8;
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+inline void
+pack_row(
+        unsigned char const* rgba,
+        std::size_t width,
+        Layout const& layout,
+        unsigned char* out)
+{
+    std::size_t const depth = static_cast<std::size_t>(layout.bit_depth);
+    std::memset(out, 0, layout.row_size);
+    uint32_t last = 0;
+    unsigned int value = 0;
+    for (std::size_t x = 0; x < width; ++x, rgba += Image::channels) {
+        uint32_t color;
+        std::memcpy(&color, rgba, sizeof(color));
+        if (x == 0 || color != last) {
+            value = layout.index.at(color);
+            last = color;
+        }
+        std::size_t const bit = x * depth;
+        out[bit / 8] = static_cast<unsigned char>(
+                    out[bit / 8] | (value << (8 - depth - bit % 8)));
+    }
+}
+
+// ----------------------------------------------------------------------------
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+inline bool
+deflate_stripe(
+        Stripe& stripe,
+        unsigned char const* dictionary,
+        std::size_t dictionary_size,
+        bool last,
+        int level,
+        int strategy)
+{
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, strategy) != Z_OK) {
+        return false;
+    }
+    if (dictionary_size != 0) {
+        deflateSetDictionary(&stream, dictionary,
+                             static_cast<uInt>(dictionary_size));
+    }
+    auto& in = stripe.filtered;
+    auto& out = stripe.compressed;
+    out.resize(deflateBound(&stream, static_cast<uLong>(in.size())) + 64);
+    std::size_t done = 0;
+    int res = Z_OK;
+    for (std::size_t pos = 0; res == Z_OK; ) {
+        std::size_t const piece = std::min(in.size() - pos, zlib_piece);
+        stream.next_in = in.data() + pos;
+        stream.avail_in = static_cast<uInt>(piece);
+        pos += piece;
+        bool const end = pos == in.size();
+        int const flush = !end ? Z_NO_FLUSH : last ? Z_FINISH : Z_SYNC_FLUSH;
+        do {
+            if (done == out.size()) {
+                out.resize(done * 2);
+            }
+            uInt const space = static_cast<uInt>(std::min(out.size() - done, zlib_piece));
+            stream.next_out = out.data() + done;
+            stream.avail_out = space;
+            res = deflate(&stream, flush);
+            done += space - stream.avail_out;
+        } while (res == Z_OK && (stream.avail_in != 0 || stream.avail_out == 0));
+        if (end) {
+            break;
+        }
+    }
+    out.resize(done);
+    deflateEnd(&stream);
+    return last ? res == Z_STREAM_END : res == Z_OK;
+}
+#pragma GCC diagnostic pop
+
+// ----------------------------------------------------------------------------
+inline bool
+write_png_parallel(
+        OutputFile& f,
+        std::size_t width,
+        std::size_t height,
+        RowProducer const& producer,
+        Layout const& layout,
+        EncodeOptions const& options,
+        std::size_t threads)
+{
+    int const level = options.level;
+    int const strategy = zlib_strategy(options);
+
+    static unsigned char const signature[8]
+            = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    unsigned char ihdr[13];
+    put_uint32(ihdr, static_cast<uint32_t>(width));
+    put_uint32(ihdr + 4, static_cast<uint32_t>(height));
+    ihdr[8] = static_cast<unsigned char>(layout.bit_depth);
+    ihdr[9] = static_cast<unsigned char>(layout.color_type);
+    ihdr[10] = PNG_COMPRESSION_TYPE_DEFAULT;
+    ihdr[11] = PNG_FILTER_TYPE_DEFAULT;
+    ihdr[12] = PNG_INTERLACE_NONE;
+    if (!f.write(signature, sizeof(signature))
+            || !write_chunk(f, "IHDR", ihdr, sizeof(ihdr))) {
+        return false;
+    }
+    if (!layout.palette.empty()) {
+        std::vector<unsigned char> plte;
+        for (auto const& color : layout.palette) {
+            plte.push_back(color.red);
+            plte.push_back(color.green);
+            plte.push_back(color.blue);
+        }
+        if (!write_chunk(f, "PLTE", plte.data(), plte.size())
+                || (!layout.transparency.empty()
+                    && !write_chunk(f, "tRNS", layout.transparency.data(),
+                                    layout.transparency.size()))) {
+            return false;
+        }
+    }
+
+    std::size_t const row_size = layout.row_size;
+    std::size_t const stripe_rows = std::max<std::size_t>(1, stripe_size / (row_size + 1));
+    std::size_t const stripe_count = (height + stripe_rows - 1) / stripe_rows;
+    std::vector<Stripe> stripes(std::min(stripe_count, threads * 2));
+    std::vector<unsigned char> buffer(layout.buffer_size);
+    std::vector<unsigned char> prev_row;
+    std::vector<unsigned char> dictionary;
+    std::vector<unsigned char> chunk;
+
+    // zlib header: 32K window and FLEVEL matching the level
+    unsigned int const cmf = 0x78;
+    unsigned int flg = level < 0 || level == 6 ? 2 : level < 2 ? 0 : level < 6 ? 1 : 3;
+    flg <<= 6;
+    flg += 31 - (cmf * 256 + flg) % 31;
+    chunk.push_back(static_cast<unsigned char>(cmf));
+    chunk.push_back(static_cast<unsigned char>(flg));
+    uLong adler = adler32(0L, nullptr, 0);
+
+    std::size_t y = 0;
+    for (std::size_t first = 0; first < stripe_count; first += stripes.size()) {
+        std::size_t const count = std::min(stripes.size(), stripe_count - first);
+        for (std::size_t i = 0; i < count; ++i) {
+            auto& stripe = stripes.at(i);
+            stripe.rows = std::min(stripe_rows, height - y);
+            stripe.raw.resize(stripe.rows * row_size);
+            for (std::size_t r = 0; r < stripe.rows; ++r, ++y) {
+                std::memcpy(stripe.raw.data() + r * row_size,
+                            producer(y, buffer.data()), row_size);
+            }
+        }
+        parallel_for(count, threads, [&] (std::size_t i)
+        {
+            auto& stripe = stripes.at(i);
+            unsigned char const* prev = nullptr;
+            if (i != 0) {
+                prev = stripes.at(i - 1).raw.data() + (stripes.at(i - 1).rows - 1) * row_size;
+            } else if (!prev_row.empty()) {
+                prev = prev_row.data();
+            }
+            std::vector<unsigned char> scratch(5 * row_size);
+            stripe.filtered.resize(stripe.rows * (row_size + 1));
+            for (std::size_t r = 0; r < stripe.rows; ++r) {
+                unsigned char const* row = stripe.raw.data() + r * row_size;
+                filter_row(row, prev, row_size,
+                           stripe.filtered.data() + r * (row_size + 1), scratch.data(),
+                           layout.bpp, options.filter);
+                prev = row;
+            }
+            auto const& filtered = stripe.filtered;
+            stripe.adler = adler32(0L, nullptr, 0);
+            for (std::size_t pos = 0; pos < filtered.size(); pos += zlib_piece) {
+                stripe.adler = adler32(stripe.adler, filtered.data() + pos, static_cast<uInt>(
+                                           std::min(filtered.size() - pos, zlib_piece)));
+            }
+        });
+        std::vector<char> results(count, 0);
+        parallel_for(count, threads, [&] (std::size_t i)
+        {
+            unsigned char const* dict = dictionary.data();
+            std::size_t dict_size = dictionary.size();
+            if (i != 0) {
+                auto const& filtered = stripes.at(i - 1).filtered;
+                dict_size = std::min(window_size, filtered.size());
+                dict = filtered.data() + filtered.size() - dict_size;
+            }
+            results.at(i) = deflate_stripe(stripes.at(i), dict, dict_size,
+                                           first + i + 1 == stripe_count,
+                                           level, strategy);
+        });
+        for (std::size_t i = 0; i < count; ++i) {
+            auto const& stripe = stripes.at(i);
+            if (!results.at(i)) {
+                return false;
+            }
+            adler = adler32_combine(adler, stripe.adler,
+                                    static_cast<z_off_t>(stripe.filtered.size()));
+            chunk.insert(chunk.end(), stripe.compressed.begin(), stripe.compressed.end());
+            if (first + i + 1 == stripe_count) {
+                unsigned char trailer[4];
+                put_uint32(trailer, static_cast<uint32_t>(adler));
+                chunk.insert(chunk.end(), trailer, trailer + 4);
+            }
+            for (std::size_t pos = 0; pos < chunk.size(); pos += max_chunk_size) {
+                if (!write_chunk(f, "IDAT", chunk.data() + pos,
+                                 std::min(chunk.size() - pos, max_chunk_size))) {
+                    return false;
+                }
+            }
+            chunk.clear();
+        }
+        auto const& last = stripes.at(count - 1);
+        prev_row.assign(last.raw.end() - static_cast<std::ptrdiff_t>(row_size), last.raw.end());
+        std::size_t const dict_size = std::min(window_size, last.filtered.size());
+        dictionary.assign(last.filtered.end() - static_cast<std::ptrdiff_t>(dict_size),
+                          last.filtered.end());
+    }
+    return write_chunk(f, "IEND", nullptr, 0);
+}
+
+// ----------------------------------------------------------------------------
+bool
+write_layout(
+        std::string const& file,
+        std::size_t width,
+        std::size_t height,
+        RowProducer const& source,
+        Layout const& layout,
+        EncodeOptions const& opts)
+{
+    std::size_t const threads = opts.threads != 0 ? opts.threads
+                                                  : hardware_threads();
+    if (threads > 1) {
+        OutputFile f;
+        if (!f.open(file) || !write_png_parallel(f, width, height, source,
+                                                 layout, opts, threads)) {
+            return false;
+        }
+        return f.close();
+    }
+
+    std::vector<unsigned char> buffer(layout.buffer_size);
+
+    png_structp png_ptr = png_create_write_struct(
+                PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    if (!png_ptr) {
+        return false;
+    }
+
+    OutputFile f;
+    png_infop png_info = png_create_info_struct(png_ptr);
+    if (!f.open(file) || !png_info || setjmp(png_jmpbuf(png_ptr))) {
+        png_destroy_write_struct(&png_ptr, &png_info);
+        return false;
+    }
+
+    png_set_write_fn(png_ptr, &f, write_data, flush_data);
+
+    png_set_IHDR(png_ptr, png_info, static_cast<png_uint_32>(width),
+                 static_cast<png_uint_32>(height), layout.bit_depth,
+                 layout.color_type, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    if (!layout.palette.empty()) {
+        png_set_PLTE(png_ptr, png_info, layout.palette.data(),
+                     static_cast<int>(layout.palette.size()));
+    }
+    if (!layout.transparency.empty()) {
+        png_set_tRNS(png_ptr, png_info, layout.transparency.data(),
+                     static_cast<int>(layout.transparency.size()), nullptr);
+    }
+    png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, png_filters(opts.filter));
+    png_set_compression_level(png_ptr, opts.level);
+    png_set_compression_strategy(png_ptr, zlib_strategy(opts));
+    png_write_info(png_ptr, png_info);
+
+    try {
+        for (std::size_t y = 0; y < height; ++y) {
+            png_write_row(png_ptr, source(y, buffer.data()));
+        }
+    } catch (...) {
+        png_destroy_write_struct(&png_ptr, &png_info);
+        throw;
+    }
+    png_write_end(png_ptr, png_info);
+
+    png_destroy_write_struct(&png_ptr, &png_info);
+
+    return f.close();
+}
+}  // namespace
+
+// ----------------------------------------------------------------------------
+bool
+write_png(
+        std::string const& file,
+        std::size_t width,
+        std::size_t height,
+        RowProducer const& producer,
+        EncodeOptions const& options)
+{
+    if (width == 0 || height == 0
+            || width > PNG_UINT_31_MAX || height > PNG_UINT_31_MAX
+            || width > std::numeric_limits<std::size_t>::max() / Image::channels
+            || options.level < Z_DEFAULT_COMPRESSION
+            || options.level > Z_BEST_COMPRESSION) {
+        return false;
+    }
+    Layout layout;
+    layout.row_size = width * Image::channels;
+    layout.buffer_size = layout.row_size;
+    RowProducer source = producer;
+    EncodeOptions opts = options;
+    std::vector<unsigned char> packed;
+    if (options.palette && make_palette(width, height, producer, layout)) {
+        packed.resize(layout.row_size);
+        source = [&] (std::size_t y, unsigned char* buffer)
+        {
+            pack_row(producer(y, buffer), width, layout, packed.data());
+            return static_cast<unsigned char const*>(packed.data());
+        };
+        if (opts.filter == RowFilter::adaptive) {
+            // indexed data rarely benefits from filtering
+            opts.filter = RowFilter::none;
+        }
+    }
+    return write_layout(file, width, height, source, layout, opts);
+}
+
+// ----------------------------------------------------------------------------
+bool
+write_png_raw(
+        std::string const& file,
+        std::size_t width,
+        std::size_t height,
+        std::size_t channels,
+        std::size_t bit_depth,
+        RowProducer const& producer,
+        EncodeOptions const& options)
+{
+    static int const color_types[] = { PNG_COLOR_TYPE_GRAY, PNG_COLOR_TYPE_GRAY_ALPHA,
+                                       PNG_COLOR_TYPE_RGB, PNG_COLOR_TYPE_RGBA };
+    if (width == 0 || height == 0
+            || width > PNG_UINT_31_MAX || height > PNG_UINT_31_MAX
+            || channels == 0 || channels > 4 || (bit_depth != 8 && bit_depth != 16)
+            || options.level < Z_DEFAULT_COMPRESSION
+            || options.level > Z_BEST_COMPRESSION) {
+        return false;
+    }
+    Layout layout;
+    layout.color_type = color_types[channels - 1];
+    layout.bit_depth = static_cast<int>(bit_depth);
+    layout.bpp = channels * bit_depth / 8;
+    layout.row_size = width * layout.bpp;
+    layout.buffer_size = layout.row_size;
+    return write_layout(file, width, height, producer, layout, options);
+}
+}  // namespace niu
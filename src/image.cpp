@@ -1,5 +1,6 @@
 #include "image.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <cstring>
 #include <fstream>
@@ -8,8 +9,6 @@
 #include <sstream>
 #include <stdexcept>
 
-#include <png.h>
-
 #define STB_IMAGE_IMPLEMENTATION
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wconversion"
@@ -18,19 +17,30 @@
 #include <stb_image.h>
 #pragma GCC diagnostic pop
 
+#include "allocator.h"
+#include "decoder.h"
+#include "encoder.h"
 #include "endian.h"
+#include "io.h"
+#include "kernels.h"
+#include "parallel.h"
 #include "utils.h"
 
 namespace niu {
 namespace {
 // ----------------------------------------------------------------------------
-template <class T>
-inline std::shared_ptr<T>
-malloc_shared_array(
-        std::size_t size)
+unsigned char const png_signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+
+// ----------------------------------------------------------------------------
+inline bool
+is_png_file(
+        std::string const& file)
 {
-    return std::shared_ptr<T>(reinterpret_cast<T*>(std::malloc(size)),
-                              [] (T* ptr) { std::free(ptr); });
+    unsigned char header[sizeof(png_signature)];
+    std::ifstream in(file, std::ios::binary);
+    in.read(reinterpret_cast<char*>(header), sizeof(header));
+    return in.gcount() == sizeof(header)
+            && std::memcmp(header, png_signature, sizeof(png_signature)) == 0;
 }
 
 // ----------------------------------------------------------------------------
@@ -42,8 +52,7 @@ image_memsize(
     std::size_t res = Image::channels;
     auto _safe_multiply = [&res] (std::size_t value)
     {
-        if (value > std::numeric_limits<int32_t>::max()
-                || std::numeric_limits<int32_t>::max() / value <= res) {
+        if (value != 0 && std::numeric_limits<std::size_t>::max() / value < res) {
             throw std::overflow_error("integer overflow");
         }
         res *= value;
@@ -87,13 +96,8 @@ add_extension(
 // ----------------------------------------------------------------------------
 inline bool
 process_check_file(
-        unsigned char const* data,
         std::string const& file)
 {
-    if (!data) {
-        std::cerr << "empty image data: " << file << std::endl;
-        return false;
-    }
     std::string dir = utils::_directory_name(file);
     if (!dir.empty()
             && !utils::_is_directory_exists(dir)
@@ -103,67 +107,45 @@ process_check_file(
     }
     return true;
 }
+}  // namespace
 
 // ----------------------------------------------------------------------------
-inline bool
-save_by_libpng(
-        std::string const& file,
-        std::size_t const w,
-        std::size_t const h,
-        std::size_t const channels,
-        unsigned char* image)
-{
-    png_structp png_ptr = png_create_write_struct(
-                PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
-    if (!png_ptr) {
-        return false;
-    }
-
-    FILE* f = fopen(file.c_str(), "wb");
-    png_infop png_info = png_create_info_struct(png_ptr);
-    if (!f || !png_info || setjmp(png_jmpbuf(png_ptr))) {
-        png_destroy_write_struct(&png_ptr, nullptr);
-        if (f) {
-            fclose(f);
-        }
-        return false;
-    }
-
-    png_init_io(png_ptr, f);
-
-    png_set_IHDR(png_ptr, png_info, static_cast<png_uint_32>(w),
-                 static_cast<png_uint_32>(h), 8,
-                 channels == 4 ? PNG_COLOR_TYPE_RGBA : PNG_COLOR_TYPE_RGB,
-                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
-                 PNG_FILTER_TYPE_DEFAULT);
-
-    unsigned char* rows[h];
-    for (std::size_t i = 0; i < h; ++i) {
-        rows[i] = image + (i * w * channels);
-    }
-
-    png_set_rows(png_ptr, png_info, rows);
-    png_write_png(png_ptr, png_info, PNG_TRANSFORM_IDENTITY, nullptr);
-    png_write_end(png_ptr, png_info);
-
-    png_destroy_write_struct(&png_ptr, nullptr);
-
-    fclose(f);
-    return true;
+std::istream&
+operator >>(
+        std::istream& os,
+        Vector2& obj)
+{
+    os >> obj.x;
+    os >> obj.y;
+    return os;
 }
-}  // namespace
 
 // ----------------------------------------------------------------------------
 std::istream&
 operator >>(
         std::istream& os,
-        Vector2& obj)
+        Point& obj)
 {
     os >> obj.x;
     os >> obj.y;
     return os;
 }
 
+// ----------------------------------------------------------------------------
+void
+clip_span(
+        std::ptrdiff_t pos,
+        std::size_t size,
+        std::size_t limit,
+        std::size_t& from,
+        std::size_t& to,
+        std::size_t& count)
+{
+    from = pos < 0 ? static_cast<std::size_t>(-pos) : 0;
+    to = pos < 0 ? 0 : static_cast<std::size_t>(pos);
+    count = from < size && to < limit ? std::min(size - from, limit - to) : 0;
+}
+
 // ----------------------------------------------------------------------------
 std::istream&
 operator >>(
@@ -190,6 +172,110 @@ operator >>(
     return os;
 }
 
+// ----------------------------------------------------------------------------
+std::istream&
+operator >>(
+        std::istream& os,
+        BlendMode& obj)
+{
+    std::string tmp;
+    os >> tmp;
+    tmp = utils::_to_lower(tmp);
+    if (tmp == "mask") {
+        obj = BlendMode::mask;
+    } else if (tmp == "copy") {
+        obj = BlendMode::copy;
+    } else if (tmp == "over") {
+        obj = BlendMode::over;
+    } else if (tmp == "multiply") {
+        obj = BlendMode::multiply;
+    } else if (tmp == "add") {
+        obj = BlendMode::add;
+    } else if (tmp == "screen") {
+        obj = BlendMode::screen;
+    } else {
+        throw std::invalid_argument("invalid BlendMode value");
+    }
+    return os;
+}
+
+// ----------------------------------------------------------------------------
+std::istream&
+operator >>(
+        std::istream& os,
+        ResampleFilter& obj)
+{
+    std::string tmp;
+    os >> tmp;
+    tmp = utils::_to_lower(tmp);
+    if (tmp == "box") {
+        obj = ResampleFilter::box;
+    } else if (tmp == "bilinear") {
+        obj = ResampleFilter::bilinear;
+    } else if (tmp == "bicubic") {
+        obj = ResampleFilter::bicubic;
+    } else if (tmp == "lanczos") {
+        obj = ResampleFilter::lanczos;
+    } else {
+        throw std::invalid_argument("invalid ResampleFilter value");
+    }
+    return os;
+}
+
+// ----------------------------------------------------------------------------
+std::istream&
+operator >>(
+        std::istream& os,
+        RowFilter& obj)
+{
+    std::string tmp;
+    os >> tmp;
+    tmp = utils::_to_lower(tmp);
+    if (tmp == "adaptive") {
+        obj = RowFilter::adaptive;
+    } else if (tmp == "none") {
+        obj = RowFilter::none;
+    } else if (tmp == "sub") {
+        obj = RowFilter::sub;
+    } else if (tmp == "up") {
+        obj = RowFilter::up;
+    } else if (tmp == "average") {
+        obj = RowFilter::average;
+    } else if (tmp == "paeth") {
+        obj = RowFilter::paeth;
+    } else {
+        throw std::invalid_argument("invalid RowFilter value");
+    }
+    return os;
+}
+
+// ----------------------------------------------------------------------------
+std::istream&
+operator >>(
+        std::istream& os,
+        Strategy& obj)
+{
+    std::string tmp;
+    os >> tmp;
+    tmp = utils::_to_lower(tmp);
+    if (tmp == "auto") {
+        obj = Strategy::automatic;
+    } else if (tmp == "default") {
+        obj = Strategy::standard;
+    } else if (tmp == "filtered") {
+        obj = Strategy::filtered;
+    } else if (tmp == "huffman") {
+        obj = Strategy::huffman;
+    } else if (tmp == "rle") {
+        obj = Strategy::rle;
+    } else if (tmp == "fixed") {
+        obj = Strategy::fixed;
+    } else {
+        throw std::invalid_argument("invalid Strategy value");
+    }
+    return os;
+}
+
 // -- Image implementation ----------------------------------------------------
 Image::Image()
     : m_width(),
@@ -204,74 +290,233 @@ Image::make_image(
         std::size_t width,
         std::size_t height)
 {
-    std::size_t const size = image_memsize(width, height);
     Image res;
     res.m_width = width;
     res.m_height = height;
-    res.m_data = malloc_shared_array<unsigned char>(size);
-    memset(res.m_data.get(), 0, size);
+    res.m_data = allocate_buffer(image_memsize(width, height));
     return res;
 }
 
+// ----------------------------------------------------------------------------
+Image
+Image::make_uninitialized(
+        std::size_t width,
+        std::size_t height)
+{
+    Image res;
+    res.m_width = width;
+    res.m_height = height;
+    res.m_data = allocate_buffer(image_memsize(width, height), false);
+    return res;
+}
+
+// ----------------------------------------------------------------------------
+Image
+Image::make_image(
+        ImageView const& view)
+{
+    std::size_t const row_size = channels * view.width();
+    Image res = make_uninitialized(view.width(), view.height());
+    for (std::size_t y = 0; y < view.height(); ++y) {
+        std::memcpy(res.m_data.get() + y * row_size, view.row(y), row_size);
+    }
+    return res;
+}
+
+// ----------------------------------------------------------------------------
+Image
+Image::clone() const
+{
+    return m_data ? make_image(view()) : Image();
+}
+
+// ----------------------------------------------------------------------------
+void
+Image::detach(
+        bool keep)
+{
+    // views and copies keep the old pixels
+    if (!m_data || m_data.use_count() == 1) {
+        return;
+    }
+    Image res = keep ? make_image(view()) : make_uninitialized(m_width, m_height);
+    m_data = std::move(res.m_data);
+}
+
+// ----------------------------------------------------------------------------
+bool
+Image::probe(
+        std::string const& file,
+        ImageInfo& info)
+{
+    // signature, IHDR length and type, width, height, bit depth, color type
+    unsigned char header[26];
+    std::ifstream in(file, std::ios::binary);
+    if (!in.is_open()) {
+        std::cerr << "Failed to open image: " << file << std::endl;
+        return false;
+    }
+    in.read(reinterpret_cast<char*>(header), sizeof(header));
+    if (in.gcount() == sizeof(header)
+            && std::memcmp(header, png_signature, sizeof(png_signature)) == 0
+            && std::memcmp(header + 12, "IHDR", 4) == 0) {
+        uint32_t value;
+        std::memcpy(&value, header + 16, sizeof(value));
+        info.width = ntohl(value);
+        std::memcpy(&value, header + 20, sizeof(value));
+        info.height = ntohl(value);
+        info.bit_depth = header[24];
+        switch (header[25]) {
+            case 0 :
+                info.channels = 1;
+                break;
+            case 4 :
+                info.channels = 2;
+                break;
+            case 6 :
+                info.channels = 4;
+                break;
+            default :
+                info.channels = 3;
+                break;
+        }
+        info.format = Format::png;
+        return true;
+    }
+    in.close();
+    int w, h, ch;
+    if (!stbi_info(file.c_str(), &w, &h, &ch)) {
+        std::cerr << "Failed to probe image: " << file << std::endl;
+        return false;
+    }
+    info.width = static_cast<std::size_t>(w);
+    info.height = static_cast<std::size_t>(h);
+    info.channels = static_cast<std::size_t>(ch);
+    info.bit_depth = stbi_is_16_bit(file.c_str()) ? 16 : 8;
+    info.format = Format::unknown;
+    return true;
+}
+
 // ----------------------------------------------------------------------------
 bool
 Image::load(
         std::string const& file)
 {
+    if (is_png_file(file)) {
+        return load_region(file, 0, 0, 0, 0);
+    }
+    MappedFile mapped;
+    if (!mapped.open(file)
+            || mapped.size() > static_cast<std::size_t>(std::numeric_limits<int>::max())) {
+        std::cerr << "Failed to load image: " << file << std::endl;
+        return false;
+    }
+    // stb_image adds the missing channels while decoding
     int w, h, ch;
     std::shared_ptr<unsigned char> data(
-                stbi_load(file.c_str(), &w, &h, &ch, 0),
+                stbi_load_from_memory(mapped.data(), static_cast<int>(mapped.size()),
+                                      &w, &h, &ch, channels),
                 [] (unsigned char* ptr) { stbi_image_free(ptr); });
     if (!data.get()) {
         std::cerr << "Failed to load image: " << file << std::endl;
         return false;
     }
-    if (ch == channels) {
-        m_width = static_cast<std::size_t>(w);
-        m_height = static_cast<std::size_t>(h);
-        m_data = data;
-        return true;
-    } else if (ch == 3) {
-        std::cout << "add alpha" << std::endl;
-        std::size_t const size = image_memsize(static_cast<std::size_t>(w),
-                                               static_cast<std::size_t>(h));
-        m_width = static_cast<std::size_t>(w);
-        m_height = static_cast<std::size_t>(h);
-        m_data = malloc_shared_array<unsigned char>(size);
-        memset(m_data.get(), 0, size);
-        for (std::size_t i = 0; i < height(); ++i) {
-            for (std::size_t j = 0; j < width(); ++j) {
-                std::size_t const index = (i * width() + j);
-                std::size_t i1 = index * channels;
-                std::size_t i2 = index * static_cast<std::size_t>(ch);
-                for (int c = 0; c < ch; ++c) {
-                    m_data.get()[i1++] = data.get()[i2++];
-                }
-                m_data.get()[i1] = static_cast<unsigned char>(255);
-            }
+    m_width = static_cast<std::size_t>(w);
+    m_height = static_cast<std::size_t>(h);
+    m_data = data;
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+bool
+Image::load_region(
+        std::string const& file,
+        std::size_t x,
+        std::size_t y,
+        std::size_t w,
+        std::size_t h)
+{
+    if (!is_png_file(file)) {
+        // no row access to other formats, decode whole image
+        Image image;
+        if (!image.load(file)) {
+            return false;
+        }
+        if (x > image.width() || y > image.height()) {
+            std::cerr << "Invalid region of image: " << file << std::endl;
+            return false;
         }
+        *this = image.sub_image(x, y, w != 0 ? w : image.width() - x,
+                                h != 0 ? h : image.height() - y);
         return true;
-    } else {
-        std::cerr << "Failed to load image: " << file
-                  << ". unsupported image format" << std::endl;
+    }
+    PngRegion region;
+    region.x = x;
+    region.y = y;
+    region.width = w;
+    region.height = h;
+    Image res;
+    if (!read_png(file, region, [&res] (std::size_t width, std::size_t height)
+    {
+        res = make_uninitialized(width, height);
+        return res.m_data.get();
+    })) {
         return false;
     }
+    std::swap(*this, res);
+    return true;
 }
 
 // ----------------------------------------------------------------------------
 bool
-Image::save(
+Image::save_rows(
+        std::string const& file,
+        std::size_t width,
+        std::size_t height,
+        RowProducer const& producer,
+        Format format,
+        EncodeOptions const& options)
+{
+    switch (format) {
+        case Format::png :
+            {
+                auto filename = add_extension(remove_extension(file), ".png");
+                if (!process_check_file(filename)) {
+                    return false;
+                }
+                if (write_png(filename, width, height, producer, options)) {
+                    return true;
+                }
+            }
+            return false;
+        default :
+            std::cerr << "Failed to save image: " << file
+                      << ". unsupported image format" << std::endl;
+            return false;
+    }
+}
+
+// ----------------------------------------------------------------------------
+bool
+Image::save_rows(
         std::string const& file,
-        Format format) const
+        std::size_t width,
+        std::size_t height,
+        std::size_t channels,
+        std::size_t bit_depth,
+        RowProducer const& producer,
+        Format format,
+        EncodeOptions const& options)
 {
     switch (format) {
         case Format::png :
             {
                 auto filename = add_extension(remove_extension(file), ".png");
-                if (!process_check_file(m_data.get(), filename)) {
+                if (!process_check_file(filename)) {
                     return false;
                 }
-                if (save_by_libpng(filename, width(), height(), channels, m_data.get())) {
+                if (write_png_raw(filename, width, height, channels, bit_depth,
+                                  producer, options)) {
                     return true;
                 }
             }
@@ -283,6 +528,27 @@ Image::save(
     }
 }
 
+// ----------------------------------------------------------------------------
+bool
+Image::save(
+        std::string const& file,
+        Format format,
+        EncodeOptions const& options) const
+{
+    return view().save(file, format, options);
+}
+
+// ----------------------------------------------------------------------------
+bool
+Image::save_upscaled(
+        std::string const& file,
+        std::size_t n,
+        Format format,
+        EncodeOptions const& options) const
+{
+    return view().save_upscaled(file, n, format, options);
+}
+
 // ----------------------------------------------------------------------------
 bool
 Image::dump(
@@ -303,6 +569,24 @@ Image::dump(
     return false;
 }
 
+// ----------------------------------------------------------------------------
+ImageView
+Image::view() const
+{
+    return ImageView(m_data, 0, width(), height(), channels * width());
+}
+
+// ----------------------------------------------------------------------------
+ImageView
+Image::view(
+        std::size_t x,
+        std::size_t y,
+        std::size_t w,
+        std::size_t h) const
+{
+    return view().sub_view(x, y, w, h);
+}
+
 // ----------------------------------------------------------------------------
 Image
 Image::sub_image(
@@ -311,79 +595,47 @@ Image::sub_image(
         std::size_t w,
         std::size_t h) const
 {
-    std::size_t const size = image_memsize(w, h);
-    if (x + w >= width() || y + h >= height()) {
-        throw std::invalid_argument("invalid sub image parameters");
-    }
-    Image res;
-    res.m_width = w;
-    res.m_height = h;
-    res.m_data = malloc_shared_array<unsigned char>(size);
-    memset(res.m_data.get(), 0, size);
-    for (std::size_t ix = 0; ix < w; ++ix) {
-        for (std::size_t iy = 0; iy < h; ++iy) {
-            std::size_t i1 = channels * (ix + iy * w);
-            std::size_t i2 = channels * ((ix + x) + (iy + y) * m_width);
-            for (std::size_t c = 0; c < channels; ++c) {
-                res.m_data.get()[i1++] = m_data.get()[i2++];
-            }
-        }
-    }
-    return res;
+    return make_image(view(x, y, w, h));
 }
 
 // ----------------------------------------------------------------------------
 void
 Image::merge(
         Image const& image,
-        Vector2 const& pos)
+        Point const& pos,
+        BlendMode mode)
 {
-    for (std::size_t ix = 0; ix < image.width(); ++ix) {
-        if (ix + pos.x < 0 || ix + pos.x >= width()) {
-            continue;
-        }
-        for (std::size_t iy = 0; iy < image.height(); ++iy) {
-            if (iy + pos.y < 0 || iy + pos.y >= height()) {
-                continue;
-            }
-            if (channels == 4 && image.m_data.get()[channels * (ix + iy * image.width()) + 3] == 0) {
-                continue;
-            }
-            std::size_t i1 = channels * (ix + pos.x + (iy + pos.y) * width());
-            std::size_t i2 = channels * (ix + iy * image.width());
-            for (std::size_t c = 0; c < channels; ++c) {
-                m_data.get()[i1++] = image.m_data.get()[i2++];
-            }
-        }
-    }
+    merge(image.view(), pos, mode);
 }
 
 // ----------------------------------------------------------------------------
 void
-Image::inverse_x()
-{
-    for (std::size_t i = 0; i < height(); ++i) {
-        for (std::size_t j = 0; j < width() / 2; ++j) {
-            std::size_t i1 = pixel_index(*this, i, j);
-            std::size_t i2 = channels * (i * (width() - j - 1) + j);
-            for (std::size_t c = 0; c < channels; ++c) {
-                std::swap(m_data.get()[i1++], m_data.get()[i2++]);
-            }
-        }
+Image::merge(
+        ImageView const& image,
+        Point const& pos,
+        BlendMode mode)
+{
+    // the overlay may hang over any edge of the canvas
+    std::size_t sx, sy, dx, dy, w, h;
+    clip_span(pos.x, image.width(), width(), sx, dx, w);
+    clip_span(pos.y, image.height(), height(), sy, dy, h);
+    if (w == 0 || h == 0) {
+        return;
     }
-}
-
-// ----------------------------------------------------------------------------
-void
-Image::inverse_y()
-{
-    for (std::size_t i = 0; i < height() / 2; ++i) {
-        for (std::size_t j = 0; j < width(); ++j) {
-            std::size_t i1 = pixel_index(*this, i, j);
-            std::size_t i2 = channels * ((height() - i - 1) * width() + j);
-            for (std::size_t c = 0; c < channels; ++c) {
-                std::swap(m_data.get()[i1++], m_data.get()[i2++]);
-            }
+    detach(true);
+    for (std::size_t iy = 0; iy < h; ++iy) {
+        unsigned char const* src = image.row(sy + iy) + sx * channels;
+        unsigned char* dst = m_data.get() + pixel_index(*this, dy + iy, dx);
+        switch (mode) {
+            case BlendMode::mask :
+                kernels::merge_masked(dst, src, w);
+                break;
+            case BlendMode::copy :
+                std::memmove(dst, src, w * channels);
+                break;
+            default :
+                kernels::blend(dst, src, w, mode);
+                break;
         }
     }
 }
@@ -401,28 +653,41 @@ Image::upscale(
 Image
 Image::upscaled(std::size_t n) const
 {
-    std::size_t const size = image_memsize(m_width * n, m_height * n);
-    Image res;
-    res.m_width = m_width * n;
-    res.m_height = m_height * n;
-    res.m_data = malloc_shared_array<unsigned char>(size);
-    memset(res.m_data.get(), 0, size);
-    for (std::size_t ix = 0; ix < width(); ++ix) {
-        for (std::size_t iy = 0; iy < height(); ++iy) {
-            std::size_t index2 = pixel_index(*this, iy, ix);
-            for (std::size_t nx = 0; nx < n; ++nx) {
-                for (std::size_t ny = 0; ny < n; ++ny) {
-                    std::size_t index1 = channels * (ix * n + nx + (iy * n + ny) * res.width());
-                    for (std::size_t c = 0; c < channels; ++c) {
-                        res.m_data.get()[index1 + c] = m_data.get()[index2 + c];
-                    }
-                }
+    if (n == 0 || m_width > std::numeric_limits<std::size_t>::max() / n
+            || m_height > std::numeric_limits<std::size_t>::max() / n) {
+        throw std::overflow_error("integer overflow");
+    }
+    Image res = make_uninitialized(m_width * n, m_height * n);
+    // every source row is expanded once, the other n - 1 rows are copies
+    std::size_t const row_size = channels * res.width();
+    unsigned char const* src = m_data.get();
+    unsigned char* dst = res.m_data.get();
+    std::size_t const w = width();
+    parallel_bands(height(), [src, dst, w, n, row_size] (std::size_t begin,
+                                                         std::size_t end)
+    {
+        for (std::size_t iy = begin; iy < end; ++iy) {
+            unsigned char* row = dst + iy * n * row_size;
+            kernels::replicate(row, src + iy * w * channels, w, n);
+            for (std::size_t ny = 1; ny < n; ++ny) {
+                std::memcpy(row + ny * row_size, row, row_size);
             }
         }
-    }
+    });
     return res;
 }
 
+// ----------------------------------------------------------------------------
+void
+Image::resize(
+        std::size_t width,
+        std::size_t height,
+        ResampleFilter filter)
+{
+    Image res = resized(width, height, filter);
+    std::swap(*this, res);
+}
+
 // ----------------------------------------------------------------------------
 void Image::set_color(
         std::size_t x,
@@ -432,27 +697,81 @@ void Image::set_color(
     if (x >= width() || y >= height()) {
         throw std::invalid_argument("invalid image parameters");
     }
-    std::size_t index = pixel_index(*this, y, x);
-    m_data.get()[index++] = color.r;
-    m_data.get()[index++] = color.g;
-    m_data.get()[index++] = color.b;
-    m_data.get()[index++] = color.a;
+    detach(true);
+    std::memcpy(m_data.get() + pixel_index(*this, y, x), &color, channels);
 }
 
 // ----------------------------------------------------------------------------
 void
-Image::fill(
-        Color color)
+Image::set_colors(
+        std::vector<ColorPoint> const& points)
 {
-    for (std::size_t i = 0; i < height(); ++i) {
-        for (std::size_t j = 0; j < width(); ++j) {
-            std::size_t index = pixel_index(*this, i, j);
-            m_data.get()[index++] = color.r;
-            m_data.get()[index++] = color.g;
-            m_data.get()[index++] = color.b;
-            m_data.get()[index++] = color.a;
+    bool sorted = true;
+    for (std::size_t i = 0; i < points.size(); ++i) {
+        auto const& point = points[i];
+        if (point.x >= width() || point.y >= height()) {
+            throw std::invalid_argument("invalid image parameters");
         }
+        sorted = sorted && (i == 0 || points[i - 1].y <= point.y);
+    }
+    if (points.empty()) {
+        return;
     }
+    detach(true);
+    unsigned char* data = m_data.get();
+    std::size_t const stride = m_width * channels;
+    if (threads() == 1) {
+        // sorting only pays off when the rows are split between workers
+        for (auto const& point : points) {
+            std::memcpy(data + point.y * stride + point.x * channels, &point.color, channels);
+        }
+        return;
+    }
+    if (sorted) {
+        // bands find their points by the row
+        auto const less = [] (ColorPoint const& point, std::size_t y) { return point.y < y; };
+        parallel_bands(m_height, [&] (std::size_t begin, std::size_t end)
+        {
+            auto it = std::lower_bound(points.begin(), points.end(), begin, less);
+            for (; it != points.end() && it->y < end; ++it) {
+                std::memcpy(data + it->y * stride + it->x * channels, &it->color, channels);
+            }
+        });
+        return;
+    }
+    // counting sort by row keeps the order of points within a row; pixel
+    // offsets are kept instead of the points to move less memory
+    std::vector<std::size_t> first(m_height + 1, 0);
+    for (auto const& point : points) {
+        ++first[point.y + 1];
+    }
+    for (std::size_t y = 0; y < m_height; ++y) {
+        first[y + 1] += first[y];
+    }
+    std::vector<std::pair<std::size_t, Color> > entries(points.size());
+    {
+        auto next = first;
+        for (auto const& point : points) {
+            entries[next[point.y]++] = std::make_pair(point.y * stride + point.x * channels,
+                                                      point.color);
+        }
+    }
+    parallel_bands(m_height, [&] (std::size_t begin, std::size_t end)
+    {
+        for (std::size_t i = first[begin]; i < first[end]; ++i) {
+            std::memcpy(data + entries[i].first, &entries[i].second, channels);
+        }
+    });
+}
+
+// ----------------------------------------------------------------------------
+void
+Image::fill(
+        Color color)
+{
+    // old pixels are overwritten anyway, a shared buffer is not copied
+    detach(false);
+    kernels::fill(m_data.get(), width() * height(), color);
 }
 
 // ----------------------------------------------------------------------------
@@ -468,4 +787,135 @@ Image::height() const noexcept
 {
     return m_height;
 }
+
+// ----------------------------------------------------------------------------
+unsigned char*
+Image::data()
+{
+    detach(true);
+    return m_data.get();
+}
+
+// -- ImageView implementation ------------------------------------------------
+ImageView::ImageView()
+    : m_data(nullptr),
+      m_offset(),
+      m_width(),
+      m_height(),
+      m_stride()
+{
+}
+
+// ----------------------------------------------------------------------------
+ImageView::ImageView(
+        std::shared_ptr<unsigned char> const& data,
+        std::size_t offset,
+        std::size_t width,
+        std::size_t height,
+        std::size_t stride)
+    : m_data(data),
+      m_offset(offset),
+      m_width(width),
+      m_height(height),
+      m_stride(stride)
+{
+}
+
+// ----------------------------------------------------------------------------
+ImageView
+ImageView::sub_view(
+        std::size_t x,
+        std::size_t y,
+        std::size_t w,
+        std::size_t h) const
+{
+    if (x > width() || w > width() - x || y > height() || h > height() - y) {
+        throw std::invalid_argument("invalid sub image parameters");
+    }
+    return ImageView(m_data, m_offset + y * m_stride + x * Image::channels,
+                     w, h, m_stride);
+}
+
+// ----------------------------------------------------------------------------
+bool
+ImageView::save(
+        std::string const& file,
+        Format format,
+        EncodeOptions const& options) const
+{
+    if (!m_data) {
+        std::cerr << "empty image data: " << file << std::endl;
+        return false;
+    }
+    std::size_t const stride = m_stride;
+    unsigned char const* data = row(0);
+    return Image::save_rows(file, width(), height(),
+                            [data, stride] (std::size_t y, unsigned char*)
+    {
+        return data + y * stride;
+    }, format, options);
+}
+
+// ----------------------------------------------------------------------------
+bool
+ImageView::save_upscaled(
+        std::string const& file,
+        std::size_t n,
+        Format format,
+        EncodeOptions const& options) const
+{
+    if (n == 1) {
+        return save(file, format, options);
+    }
+    if (!m_data) {
+        std::cerr << "empty image data: " << file << std::endl;
+        return false;
+    }
+    if (n == 0 || width() > std::numeric_limits<std::size_t>::max() / n
+            || height() > std::numeric_limits<std::size_t>::max() / n) {
+        throw std::overflow_error("integer overflow");
+    }
+    // the enlarged image is never materialized: each source row is expanded
+    // once and handed out n times
+    std::size_t const w = width();
+    std::size_t const stride = m_stride;
+    unsigned char const* data = row(0);
+    return Image::save_rows(file, w * n, height() * n,
+                            [data, w, n, stride] (std::size_t y, unsigned char* buffer)
+    {
+        if (y % n == 0) {
+            kernels::replicate(buffer, data + (y / n) * stride, w, n);
+        }
+        return buffer;
+    }, format, options);
+}
+
+// ----------------------------------------------------------------------------
+unsigned char const*
+ImageView::row(
+        std::size_t y) const noexcept
+{
+    return m_data.get() + m_offset + y * m_stride;
+}
+
+// ----------------------------------------------------------------------------
+std::size_t
+ImageView::width() const noexcept
+{
+    return m_width;
+}
+
+// ----------------------------------------------------------------------------
+std::size_t
+ImageView::height() const noexcept
+{
+    return m_height;
+}
+
+// ----------------------------------------------------------------------------
+std::size_t
+ImageView::stride() const noexcept
+{
+    return m_stride;
+}
 }  // namespace niu
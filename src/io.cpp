@@ -0,0 +1,184 @@
+#include "io.h"
+
+#include <cstring>
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define NIU_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif  // __unix__ || __APPLE__
+
+namespace niu {
+// -- MappedFile implementation -----------------------------------------------
+MappedFile::MappedFile()
+    : m_map(nullptr),
+      m_size(0),
+      m_buffer()
+{
+}
+
+// ----------------------------------------------------------------------------
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+// ----------------------------------------------------------------------------
+bool
+MappedFile::open(
+        std::string const& file)
+{
+    close();
+#if defined(NIU_MMAP)
+    int const fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    if (st.st_size > 0) {
+        m_size = static_cast<std::size_t>(st.st_size);
+        m_map = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m_map == MAP_FAILED) {
+            m_map = nullptr;
+            m_size = 0;
+        } else {
+            // decoders read front to back
+            madvise(m_map, m_size, MADV_SEQUENTIAL);
+        }
+    }
+    ::close(fd);
+    if (m_map || st.st_size == 0) {
+        return true;
+    }
+#endif  // NIU_MMAP
+    // no mapping, read the whole file
+    std::ifstream in(file, std::ios::binary | std::ios::ate);
+    if (!in.is_open()) {
+        return false;
+    }
+    auto const size = in.tellg();
+    if (size < 0) {
+        return false;
+    }
+    m_buffer.resize(static_cast<std::size_t>(size));
+    in.seekg(0);
+    in.read(reinterpret_cast<char*>(m_buffer.data()), size);
+    m_size = m_buffer.size();
+    return static_cast<bool>(in);
+}
+
+// ----------------------------------------------------------------------------
+void
+MappedFile::close()
+{
+#if defined(NIU_MMAP)
+    if (m_map) {
+        munmap(m_map, m_size);
+    }
+#endif  // NIU_MMAP
+    m_map = nullptr;
+    m_size = 0;
+    m_buffer.clear();
+}
+
+// ----------------------------------------------------------------------------
+unsigned char const*
+MappedFile::data() const noexcept
+{
+    return m_map ? static_cast<unsigned char const*>(m_map) : m_buffer.data();
+}
+
+// ----------------------------------------------------------------------------
+std::size_t
+MappedFile::size() const noexcept
+{
+    return m_size;
+}
+
+// -- OutputFile implementation -----------------------------------------------
+OutputFile::OutputFile(
+        std::size_t capacity)
+    : m_file(nullptr),
+      m_capacity(capacity),
+      m_buffer(),
+      m_good(false)
+{
+}
+
+// ----------------------------------------------------------------------------
+OutputFile::~OutputFile()
+{
+    close();
+}
+
+// ----------------------------------------------------------------------------
+bool
+OutputFile::open(
+        std::string const& file)
+{
+    close();
+    m_file = std::fopen(file.c_str(), "wb");
+    if (!m_file) {
+        return false;
+    }
+    // our own buffer replaces the stdio one, so every flush is one write
+    std::setvbuf(m_file, nullptr, _IONBF, 0);
+    m_buffer.reserve(m_capacity);
+    m_good = true;
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+bool
+OutputFile::write(
+        void const* data,
+        std::size_t size)
+{
+    if (!m_good) {
+        return false;
+    }
+    if (m_buffer.size() + size > m_capacity && !flush()) {
+        return false;
+    }
+    if (size > m_capacity) {
+        m_good = std::fwrite(data, 1, size, m_file) == size;
+        return m_good;
+    }
+    auto const ptr = static_cast<unsigned char const*>(data);
+    m_buffer.insert(m_buffer.end(), ptr, ptr + size);
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+bool
+OutputFile::flush()
+{
+    if (!m_buffer.empty()) {
+        m_good = m_good
+                && std::fwrite(m_buffer.data(), 1, m_buffer.size(), m_file) == m_buffer.size();
+        m_buffer.clear();
+    }
+    return m_good;
+}
+
+// ----------------------------------------------------------------------------
+bool
+OutputFile::close()
+{
+    if (!m_file) {
+        return false;
+    }
+    bool res = flush();
+    res = std::fclose(m_file) == 0 && res;
+    m_file = nullptr;
+    m_good = false;
+    return res;
+}
+}  // namespace niu
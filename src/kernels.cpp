@@ -0,0 +1,549 @@
+#include "kernels.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+#define NIU_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif  // _MSC_VER
+#if defined(__GNUC__)
+#define NIU_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define NIU_TARGET_AVX2
+#endif  // __GNUC__
+#endif  // x86
+
+namespace niu {
+namespace kernels {
+namespace {
+// ----------------------------------------------------------------------------
+inline uint32_t
+load_pixel(unsigned char const* src)
+{
+    uint32_t res;
+    std::memcpy(&res, src, sizeof(res));
+    return res;
+}
+
+// ----------------------------------------------------------------------------
+inline void
+store_pixel(
+        unsigned char* dst,
+        uint32_t value)
+{
+    std::memcpy(dst, &value, sizeof(value));
+}
+
+// -- scalar ------------------------------------------------------------------
+void
+fill_scalar(
+        unsigned char* dst,
+        std::size_t count,
+        Color color)
+{
+    for (std::size_t i = 0; i < count; ++i, dst += Image::channels) {
+        store_pixel(dst, color.value);
+    }
+}
+
+// ----------------------------------------------------------------------------
+void
+merge_masked_scalar(
+        unsigned char* dst,
+        unsigned char const* src,
+        std::size_t count)
+{
+    for (std::size_t i = 0; i < count; ++i) {
+        if (src[3] != 0) {
+            std::memcpy(dst, src, Image::channels);
+        }
+        dst += Image::channels;
+        src += Image::channels;
+    }
+}
+
+// ----------------------------------------------------------------------------
+void
+replicate_scalar(
+        unsigned char* dst,
+        unsigned char const* src,
+        std::size_t count,
+        std::size_t n)
+{
+    for (std::size_t i = 0; i < count; ++i, src += Image::channels) {
+        uint32_t const value = load_pixel(src);
+        for (std::size_t j = 0; j < n; ++j, dst += Image::channels) {
+            store_pixel(dst, value);
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// round(value / 255) for value in [0, 65535]
+inline unsigned int
+div255(unsigned int value)
+{
+    value += 128;
+    return (value + (value >> 8)) >> 8;
+}
+
+// ----------------------------------------------------------------------------
+inline unsigned int
+blend_channel(
+        unsigned int s,
+        unsigned int d,
+        BlendMode mode)
+{
+    switch (mode) {
+        case BlendMode::multiply :
+            return div255(s * d);
+        case BlendMode::add :
+            return std::min(255u, s + d);
+        case BlendMode::screen :
+            return s + d - div255(s * d);
+        default :
+            return s;
+    }
+}
+
+// ----------------------------------------------------------------------------
+void
+blend_scalar(
+        unsigned char* dst,
+        unsigned char const* src,
+        std::size_t count,
+        BlendMode mode)
+{
+    for (std::size_t i = 0; i < count; ++i) {
+        unsigned int const sa = src[3];
+        unsigned int const da = dst[3];
+        if (sa == 0) {
+            // nothing to composite
+        } else if (da == 255) {
+            for (std::size_t c = 0; c < 3; ++c) {
+                unsigned int const b = blend_channel(src[c], dst[c], mode);
+                dst[c] = static_cast<unsigned char>(div255(sa * b + (255 - sa) * dst[c]));
+            }
+        } else {
+            // W3C compositing: the blended color is weighted by the backdrop
+            // alpha, then composited source-over with straight alpha
+            unsigned int const ws = sa * 255;
+            unsigned int const wd = da * (255 - sa);
+            unsigned int const total = ws + wd;
+            for (std::size_t c = 0; c < 3; ++c) {
+                unsigned int const b = blend_channel(src[c], dst[c], mode);
+                unsigned int const cs = div255((255 - da) * src[c] + da * b);
+                dst[c] = static_cast<unsigned char>(
+                            (ws * cs + wd * dst[c] + total / 2) / total);
+            }
+            dst[3] = static_cast<unsigned char>(div255(total));
+        }
+        dst += Image::channels;
+        src += Image::channels;
+    }
+}
+
+// ----------------------------------------------------------------------------
+void
+reverse_scalar(
+        unsigned char* row,
+        std::size_t count)
+{
+    unsigned char* end = row + count * Image::channels;
+    for (; count >= 2; count -= 2, row += Image::channels) {
+        end -= Image::channels;
+        uint32_t const pixel = load_pixel(row);
+        store_pixel(row, load_pixel(end));
+        store_pixel(end, pixel);
+    }
+}
+
+// ----------------------------------------------------------------------------
+void
+transpose_scalar(
+        unsigned char* dst,
+        std::ptrdiff_t dst_stride,
+        bool reverse,
+        unsigned char const* src,
+        std::size_t src_stride,
+        std::size_t width,
+        std::size_t height)
+{
+    std::ptrdiff_t const step = reverse ? -static_cast<std::ptrdiff_t>(Image::channels)
+                                        : static_cast<std::ptrdiff_t>(Image::channels);
+    for (std::size_t y = 0; y < height; ++y) {
+        unsigned char const* from = src + y * src_stride;
+        unsigned char* to = dst + static_cast<std::ptrdiff_t>(y) * step;
+        for (std::size_t x = 0; x < width; ++x, from += Image::channels, to += dst_stride) {
+            store_pixel(to, load_pixel(from));
+        }
+    }
+}
+
+#if defined(NIU_X86)
+// -- sse2 --------------------------------------------------------------------
+void
+fill_sse2(
+        unsigned char* dst,
+        std::size_t count,
+        Color color)
+{
+    __m128i const value = _mm_set1_epi32(static_cast<int>(color.value));
+    for (; count >= 4; count -= 4, dst += 16) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), value);
+    }
+    fill_scalar(dst, count, color);
+}
+
+// ----------------------------------------------------------------------------
+void
+merge_masked_sse2(
+        unsigned char* dst,
+        unsigned char const* src,
+        std::size_t count)
+{
+    __m128i const alpha = _mm_set1_epi32(static_cast<int>(0xff000000));
+    __m128i const zero = _mm_setzero_si128();
+    for (; count >= 4; count -= 4, dst += 16, src += 16) {
+        __m128i const s = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src));
+        __m128i const d = _mm_loadu_si128(reinterpret_cast<__m128i const*>(dst));
+        __m128i const hidden = _mm_cmpeq_epi32(_mm_and_si128(s, alpha), zero);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst),
+                         _mm_or_si128(_mm_and_si128(hidden, d),
+                                      _mm_andnot_si128(hidden, s)));
+    }
+    merge_masked_scalar(dst, src, count);
+}
+
+// ----------------------------------------------------------------------------
+void
+replicate_sse2(
+        unsigned char* dst,
+        unsigned char const* src,
+        std::size_t count,
+        std::size_t n)
+{
+    if (n == 2) {
+        for (; count >= 4; count -= 4, src += 16, dst += 32) {
+            __m128i const s = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi32(s, s));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16), _mm_unpackhi_epi32(s, s));
+        }
+    } else if (n == 4) {
+        for (; count >= 4; count -= 4, src += 16, dst += 64) {
+            __m128i const s = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_shuffle_epi32(s, 0x00));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16), _mm_shuffle_epi32(s, 0x55));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 32), _mm_shuffle_epi32(s, 0xaa));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 48), _mm_shuffle_epi32(s, 0xff));
+        }
+    } else if (n > 4) {
+        for (; count != 0; --count, src += Image::channels) {
+            __m128i const value = _mm_set1_epi32(static_cast<int>(load_pixel(src)));
+            std::size_t j = 0;
+            for (; j + 4 <= n; j += 4, dst += 16) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), value);
+            }
+            for (; j < n; ++j, dst += Image::channels) {
+                std::memcpy(dst, src, Image::channels);
+            }
+        }
+    }
+    replicate_scalar(dst, src, count, n);
+}
+
+// ----------------------------------------------------------------------------
+inline __m128i
+div255_epi16(__m128i value)
+{
+    value = _mm_add_epi16(value, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(value, _mm_srli_epi16(value, 8)), 8);
+}
+
+// ----------------------------------------------------------------------------
+// blends two pixels widened to 16 bit lanes onto an opaque backdrop
+inline __m128i
+blend_epi16(
+        __m128i s,
+        __m128i d,
+        BlendMode mode)
+{
+    __m128i const full = _mm_set1_epi16(255);
+    __m128i b = s;
+    switch (mode) {
+        case BlendMode::multiply :
+            b = div255_epi16(_mm_mullo_epi16(s, d));
+            break;
+        case BlendMode::add :
+            b = _mm_min_epi16(_mm_add_epi16(s, d), full);
+            break;
+        case BlendMode::screen :
+            b = _mm_sub_epi16(_mm_add_epi16(s, d), div255_epi16(_mm_mullo_epi16(s, d)));
+            break;
+        default :
+            break;
+    }
+    __m128i const sa = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xff), 0xff);
+    return div255_epi16(_mm_add_epi16(_mm_mullo_epi16(sa, b),
+                                      _mm_mullo_epi16(_mm_sub_epi16(full, sa), d)));
+}
+
+// ----------------------------------------------------------------------------
+void
+blend_sse2(
+        unsigned char* dst,
+        unsigned char const* src,
+        std::size_t count,
+        BlendMode mode)
+{
+    __m128i const alpha = _mm_set1_epi32(static_cast<int>(0xff000000));
+    __m128i const zero = _mm_setzero_si128();
+    for (; count >= 4; count -= 4, dst += 16, src += 16) {
+        __m128i const s = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src));
+        __m128i const d = _mm_loadu_si128(reinterpret_cast<__m128i const*>(dst));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(d, alpha), alpha)) != 0xffff) {
+            // translucent backdrop needs the division of the exact formula
+            blend_scalar(dst, src, 4, mode);
+            continue;
+        }
+        __m128i const lo = blend_epi16(_mm_unpacklo_epi8(s, zero),
+                                       _mm_unpacklo_epi8(d, zero), mode);
+        __m128i const hi = blend_epi16(_mm_unpackhi_epi8(s, zero),
+                                       _mm_unpackhi_epi8(d, zero), mode);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst),
+                         _mm_or_si128(_mm_packus_epi16(lo, hi), alpha));
+    }
+    blend_scalar(dst, src, count, mode);
+}
+
+// ----------------------------------------------------------------------------
+void
+reverse_sse2(
+        unsigned char* row,
+        std::size_t count)
+{
+    unsigned char* end = row + count * Image::channels;
+    for (; count >= 8; count -= 8, row += 16) {
+        end -= 16;
+        __m128i const a = _mm_loadu_si128(reinterpret_cast<__m128i const*>(row));
+        __m128i const b = _mm_loadu_si128(reinterpret_cast<__m128i const*>(end));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(row), _mm_shuffle_epi32(b, 0x1b));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(end), _mm_shuffle_epi32(a, 0x1b));
+    }
+    reverse_scalar(row, count);
+}
+
+// ----------------------------------------------------------------------------
+void
+transpose_sse2(
+        unsigned char* dst,
+        std::ptrdiff_t dst_stride,
+        bool reverse,
+        unsigned char const* src,
+        std::size_t src_stride,
+        std::size_t width,
+        std::size_t height)
+{
+    std::ptrdiff_t const pixel = static_cast<std::ptrdiff_t>(Image::channels);
+    std::size_t const w4 = width & ~std::size_t(3);
+    std::size_t const h4 = height & ~std::size_t(3);
+    for (std::size_t y = 0; y < h4; y += 4) {
+        // destination of source row y, reversed rows run right to left
+        std::ptrdiff_t const column = reverse ? -static_cast<std::ptrdiff_t>(y + 3) * pixel
+                                              : static_cast<std::ptrdiff_t>(y) * pixel;
+        for (std::size_t x = 0; x < w4; x += 4) {
+            unsigned char const* from = src + y * src_stride + x * Image::channels;
+            __m128i const r0 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(from));
+            __m128i const r1 = _mm_loadu_si128(
+                        reinterpret_cast<__m128i const*>(from + src_stride));
+            __m128i const r2 = _mm_loadu_si128(
+                        reinterpret_cast<__m128i const*>(from + 2 * src_stride));
+            __m128i const r3 = _mm_loadu_si128(
+                        reinterpret_cast<__m128i const*>(from + 3 * src_stride));
+            // 4x4 transpose of 32-bit pixels in registers
+            __m128i const t0 = _mm_unpacklo_epi32(r0, r1);
+            __m128i const t1 = _mm_unpacklo_epi32(r2, r3);
+            __m128i const t2 = _mm_unpackhi_epi32(r0, r1);
+            __m128i const t3 = _mm_unpackhi_epi32(r2, r3);
+            __m128i out[4] = { _mm_unpacklo_epi64(t0, t1), _mm_unpackhi_epi64(t0, t1),
+                               _mm_unpacklo_epi64(t2, t3), _mm_unpackhi_epi64(t2, t3) };
+            unsigned char* to = dst + static_cast<std::ptrdiff_t>(x) * dst_stride + column;
+            for (std::size_t i = 0; i < 4; ++i, to += dst_stride) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(to),
+                                 reverse ? _mm_shuffle_epi32(out[i], 0x1b) : out[i]);
+            }
+        }
+    }
+    std::ptrdiff_t const step = reverse ? -pixel : pixel;
+    // right columns of all rows, then bottom rows of the rest
+    transpose_scalar(dst + static_cast<std::ptrdiff_t>(w4) * dst_stride, dst_stride, reverse,
+                     src + w4 * Image::channels, src_stride, width - w4, height);
+    transpose_scalar(dst + static_cast<std::ptrdiff_t>(h4) * step, dst_stride, reverse,
+                     src + h4 * src_stride, src_stride, w4, height - h4);
+}
+
+// -- avx2 --------------------------------------------------------------------
+NIU_TARGET_AVX2 void
+fill_avx2(
+        unsigned char* dst,
+        std::size_t count,
+        Color color)
+{
+    __m256i const value = _mm256_set1_epi32(static_cast<int>(color.value));
+    for (; count >= 8; count -= 8, dst += 32) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), value);
+    }
+    fill_scalar(dst, count, color);
+}
+
+// ----------------------------------------------------------------------------
+NIU_TARGET_AVX2 void
+merge_masked_avx2(
+        unsigned char* dst,
+        unsigned char const* src,
+        std::size_t count)
+{
+    __m256i const alpha = _mm256_set1_epi32(static_cast<int>(0xff000000));
+    __m256i const zero = _mm256_setzero_si256();
+    for (; count >= 8; count -= 8, dst += 32, src += 32) {
+        __m256i const s = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(src));
+        __m256i const d = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(dst));
+        __m256i const hidden = _mm256_cmpeq_epi32(_mm256_and_si256(s, alpha), zero);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst),
+                            _mm256_blendv_epi8(s, d, hidden));
+    }
+    merge_masked_scalar(dst, src, count);
+}
+
+// ----------------------------------------------------------------------------
+inline bool
+has_avx2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    // OSXSAVE and AVX, then the OS must preserve the YMM state
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0
+            || (_xgetbv(0) & 6) != 6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#elif defined(__GNUC__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+#else
+    return false;
+#endif  // _MSC_VER
+}
+#endif  // NIU_X86
+
+// -- dispatch ----------------------------------------------------------------
+struct Dispatch
+{
+    void (*fill)(unsigned char*, std::size_t, Color);
+    void (*merge_masked)(unsigned char*, unsigned char const*, std::size_t);
+    void (*replicate)(unsigned char*, unsigned char const*, std::size_t, std::size_t);
+    void (*blend)(unsigned char*, unsigned char const*, std::size_t, BlendMode);
+    void (*reverse)(unsigned char*, std::size_t);
+    void (*transpose)(unsigned char*, std::ptrdiff_t, bool, unsigned char const*,
+                      std::size_t, std::size_t, std::size_t);
+};
+
+// ----------------------------------------------------------------------------
+inline Dispatch
+detect()
+{
+#if defined(NIU_X86)
+    if (has_avx2()) {
+        return Dispatch{ fill_avx2, merge_masked_avx2, replicate_sse2, blend_sse2,
+                         reverse_sse2, transpose_sse2 };
+    }
+    return Dispatch{ fill_sse2, merge_masked_sse2, replicate_sse2, blend_sse2,
+                     reverse_sse2, transpose_sse2 };
+#else
+    return Dispatch{ fill_scalar, merge_masked_scalar, replicate_scalar, blend_scalar,
+                     reverse_scalar, transpose_scalar };
+#endif  // NIU_X86
+}
+
+// ----------------------------------------------------------------------------
+inline Dispatch const&
+dispatch()
+{
+    static Dispatch const res = detect();
+    return res;
+}
+}  // namespace
+
+// ----------------------------------------------------------------------------
+void
+fill(unsigned char* dst,
+        std::size_t count,
+        Color color)
+{
+    dispatch().fill(dst, count, color);
+}
+
+// ----------------------------------------------------------------------------
+void
+merge_masked(
+        unsigned char* dst,
+        unsigned char const* src,
+        std::size_t count)
+{
+    dispatch().merge_masked(dst, src, count);
+}
+
+// ----------------------------------------------------------------------------
+void
+replicate(
+        unsigned char* dst,
+        unsigned char const* src,
+        std::size_t count,
+        std::size_t n)
+{
+    dispatch().replicate(dst, src, count, n);
+}
+
+// ----------------------------------------------------------------------------
+void
+blend(unsigned char* dst,
+        unsigned char const* src,
+        std::size_t count,
+        BlendMode mode)
+{
+    dispatch().blend(dst, src, count, mode);
+}
+
+// ----------------------------------------------------------------------------
+void
+reverse(unsigned char* row,
+        std::size_t count)
+{
+    dispatch().reverse(row, count);
+}
+
+// ----------------------------------------------------------------------------
+void
+transpose(
+        unsigned char* dst,
+        std::ptrdiff_t dst_stride,
+        bool reverse,
+        unsigned char const* src,
+        std::size_t src_stride,
+        std::size_t width,
+        std::size_t height)
+{
+    dispatch().transpose(dst, dst_stride, reverse, src, src_stride, width, height);
+}
+}  // namespace kernels
+}  // namespace niu
@@ -1,13 +1,710 @@
 #include <argparse/argparse_decl.hpp>
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdio>
+#include <fstream>
 #include <map>
+#include <sstream>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
+#include "any_image.h"
+#include "atlas.h"
+#include "batch.h"
 #include "image.h"
+#include "kernels.h"
+#include "parallel.h"
+#include "pipeline.h"
+#include "points.h"
+#include "tiled_image.h"
 #include "utils.h"
 
+namespace {
+// ----------------------------------------------------------------------------
+niu::EncodeOptions
+encode_options(
+        argparse::Namespace const& args)
+{
+    niu::EncodeOptions res;
+    res.level = args.get<int>("level");
+    res.filter = args.get<niu::RowFilter>("filter");
+    res.strategy = args.get<niu::Strategy>("strategy");
+    res.threads = args.get<std::size_t>("threads");
+    res.palette = args.get<bool>("palette");
+    return res;
+}
+
+// ----------------------------------------------------------------------------
+int
+process_file(
+        std::string const& command,
+        niu::Pipeline const& pipeline,
+        niu::EncodeOptions const& options,
+        std::string const& input,
+        std::string const& output,
+        std::string& message)
+{
+    if (!niu::utils::_is_file_exists(input)) {
+        message = "[FAIL] Input file '" + input + "' not found";
+        return 1;
+    }
+
+    // images other than 8-bit RGBA stay in their own pixel format when no
+    // step needs RGBA or a color the format can't hold
+    niu::ImageInfo info;
+    if (command != "dump" && niu::Image::probe(input, info)
+            && (info.channels != niu::Image::channels || info.bit_depth != 8)
+            && pipeline.keeps_format(info.channels)) {
+        niu::AnyImage image;
+        if (!image.load(input)) {
+            message = "[FAIL] Can't load file '" + input + "' as image";
+            return 2;
+        }
+        try {
+            auto const scale = pipeline.apply_deferred(image);
+            if (!image.save_upscaled(output, scale, niu::Format::png, options)) {
+                message = "[FAIL] Can't save file '" + output + "'";
+                return 1;
+            }
+        } catch (std::exception const& e) {
+            message = "[FAIL] File '" + input + "': " + e.what();
+            return 1;
+        }
+        message = "[ OK ] File '" + output + "' saved";
+        return 0;
+    }
+
+    niu::Image image;
+    if (!image.load(input)) {
+        message = "[FAIL] Can't load file '" + input + "' as image";
+        return 2;
+    }
+
+    // saving upscales on the fly and throws if the result is too large
+    try {
+        if (command == "dump") {
+            pipeline.apply(image);
+            if (!image.dump(output)) {
+                message = "[FAIL] Can't dump to file '" + output + "'";
+                return 1;
+            }
+        } else {
+            auto const scale = pipeline.apply_deferred(image);
+            if (!image.save_upscaled(output, scale, niu::Format::png, options)) {
+                message = "[FAIL] Can't save file '" + output + "'";
+                return 1;
+            }
+        }
+    } catch (std::exception const& e) {
+        message = "[FAIL] File '" + input + "': " + e.what();
+        return 1;
+    }
+
+    message = "[ OK ] File '" + output + "' saved";
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+// fill, merge or set_color on an image kept as tiles, see TiledImage
+int
+process_tiled(
+        std::string const& command,
+        niu::Pipeline const& pipeline,
+        std::size_t ram_budget,
+        std::string const& scratch_dir,
+        niu::EncodeOptions const& options,
+        std::string const& input,
+        std::string const& output,
+        std::string& message)
+{
+    if (!niu::utils::_is_file_exists(input)) {
+        message = "[FAIL] Input file '" + input + "' not found";
+        return 1;
+    }
+
+    niu::ImageInfo info;
+    if (!niu::Image::probe(input, info)) {
+        message = "[FAIL] Can't load file '" + input + "' as image";
+        return 2;
+    }
+
+    try {
+        niu::TiledImage image(info.width, info.height, ram_budget, scratch_dir);
+        // a fill overwrites every pixel, so there is nothing to read
+        if (command != "fill" && !image.load(input)) {
+            message = "[FAIL] Can't load file '" + input + "' as image";
+            return 2;
+        }
+        pipeline.apply(image);
+        if (!image.save(output, niu::Format::png, options)) {
+            message = "[FAIL] Can't save file '" + output + "'";
+            return 1;
+        }
+    } catch (std::exception const& e) {
+        message = "[FAIL] File '" + input + "': " + e.what();
+        return 1;
+    }
+
+    message = "[ OK ] File '" + output + "' saved";
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+std::string
+json_string(
+        std::string const& str)
+{
+    std::string res = "\"";
+    for (auto c : str) {
+        if (c == '"' || c == '\\') {
+            res += '\\';
+            res += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", static_cast<unsigned>(c));
+            res += buf;
+        } else {
+            res += c;
+        }
+    }
+    return res + "\"";
+}
+
+// ----------------------------------------------------------------------------
+int
+print_info(
+        std::vector<std::string> const& patterns,
+        std::size_t jobs,
+        bool json)
+{
+    std::vector<std::string> files;
+    for (auto const& pattern : patterns) {
+        auto const expanded = niu::expand_input(pattern);
+        files.insert(files.end(), expanded.begin(), expanded.end());
+    }
+    if (files.empty()) {
+        std::cerr << "[FAIL] No input files found" << std::endl;
+        return 1;
+    }
+
+    std::vector<niu::ImageInfo> infos(files.size());
+    std::vector<char> ok(files.size(), 0);
+    niu::parallel_for(files.size(), jobs, [&] (std::size_t i)
+    {
+        ok.at(i) = niu::utils::_is_file_exists(files.at(i))
+                && niu::Image::probe(files.at(i), infos.at(i));
+    });
+
+    int res = 0;
+    if (json) {
+        std::cout << "[";
+    }
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        auto const& info = infos.at(i);
+        if (!ok.at(i)) {
+            res = 1;
+        }
+        if (json) {
+            std::cout << (i == 0 ? "\n" : ",\n") << "  { \"file\": " << json_string(files.at(i));
+            if (ok.at(i)) {
+                std::cout << ", \"width\": " << info.width
+                          << ", \"height\": " << info.height
+                          << ", \"channels\": " << info.channels
+                          << ", \"bit_depth\": " << info.bit_depth << " }";
+            } else {
+                std::cout << ", \"error\": \"can't read header\" }";
+            }
+        } else if (ok.at(i)) {
+            std::cout << files.at(i) << ": " << info.width << "x" << info.height
+                      << ", " << info.channels << " channel(s), "
+                      << info.bit_depth << " bit" << std::endl;
+        } else {
+            std::cerr << "[FAIL] Can't read header of '" << files.at(i) << "'" << std::endl;
+        }
+    }
+    if (json) {
+        std::cout << "\n]" << std::endl;
+    }
+    return res;
+}
+
+// ----------------------------------------------------------------------------
+// 'out.png' -> 'out_2.png', or 'key' (e.g. '{level}') replaced in the path
+std::string
+suffixed_path(
+        std::string const& output,
+        std::string const& key,
+        std::string const& value)
+{
+    auto const pos = output.find(key);
+    if (pos != std::string::npos) {
+        return output.substr(0, pos) + value + output.substr(pos + key.size());
+    }
+    auto const dot = output.find_last_of('.');
+    auto const slash = output.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return output + "_" + value;
+    }
+    return output.substr(0, dot) + "_" + value + output.substr(dot);
+}
+
+// ----------------------------------------------------------------------------
+std::string
+level_path(
+        std::string const& output,
+        std::size_t level)
+{
+    return suffixed_path(output, "{level}", std::to_string(level));
+}
+
+// ----------------------------------------------------------------------------
+int
+process_crop(
+        niu::Point const& position,
+        niu::Vector2 const& size,
+        niu::EncodeOptions const& options,
+        std::string const& input,
+        std::string const& output,
+        std::string& message)
+{
+    if (!niu::utils::_is_file_exists(input)) {
+        message = "[FAIL] Input file '" + input + "' not found";
+        return 1;
+    }
+    if (position.x < 0 || position.y < 0) {
+        message = "[FAIL] Invalid crop position";
+        return 1;
+    }
+
+    niu::Image image;
+    if (!image.load_region(input, static_cast<std::size_t>(position.x),
+                           static_cast<std::size_t>(position.y), size.w, size.h)) {
+        message = "[FAIL] Can't load region of file '" + input + "'";
+        return 2;
+    }
+
+    if (!image.save(output, niu::Format::png, options)) {
+        message = "[FAIL] Can't save file '" + output + "'";
+        return 1;
+    }
+
+    message = "[ OK ] File '" + output + "' saved";
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+int
+process_pyramid(
+        std::size_t levels,
+        niu::ResampleFilter filter,
+        std::size_t jobs,
+        niu::EncodeOptions const& options,
+        std::string const& input,
+        std::string const& output,
+        std::string& message)
+{
+    if (!niu::utils::_is_file_exists(input)) {
+        message = "[FAIL] Input file '" + input + "' not found";
+        return 1;
+    }
+
+    niu::Image image;
+    if (!image.load(input)) {
+        message = "[FAIL] Can't load file '" + input + "' as image";
+        return 2;
+    }
+
+    // levels are saved in parallel, each one on a single thread
+    auto const pyramid = image.pyramid(levels, filter);
+    auto level_options = options;
+    level_options.threads = 1;
+    std::vector<char> saved(pyramid.size(), 0);
+    niu::parallel_for(pyramid.size(), jobs, [&] (std::size_t i)
+    {
+        saved.at(i) = pyramid.at(i).save(level_path(output, i + 1),
+                                         niu::Format::png, level_options);
+    });
+    for (std::size_t i = 0; i < saved.size(); ++i) {
+        if (!saved.at(i)) {
+            message = "[FAIL] Can't save file '" + level_path(output, i + 1) + "'";
+            return 1;
+        }
+    }
+
+    message = "[ OK ] File '" + input + "': " + std::to_string(pyramid.size())
+            + " level(s) saved";
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+bool
+read_rows(
+        std::string const& file,
+        std::vector<std::string>& rows)
+{
+    std::ifstream in(file);
+    if (!in.is_open()) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        rows.push_back(line);
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+int
+render_pattern(
+        std::string const& output,
+        std::vector<std::string> const& rows,
+        std::map<char, niu::Color> const& colormap,
+        std::map<char, std::string> const& spritemap,
+        niu::EncodeOptions const& options)
+{
+    // every file is decoded once, even if several symbols use it
+    std::vector<std::string> files;
+    for (auto const& sprite : spritemap) {
+        if (std::find(files.begin(), files.end(), sprite.second) == files.end()) {
+            files.push_back(sprite.second);
+        }
+    }
+    std::vector<niu::Image> images(files.size());
+    std::vector<char> loaded(files.size(), 0);
+    niu::parallel_for(files.size(), niu::threads(), [&] (std::size_t i)
+    {
+        loaded.at(i) = niu::utils::_is_file_exists(files.at(i))
+                && images.at(i).load(files.at(i));
+    });
+    std::map<char, niu::Image> sprites;
+    niu::Vector2 tile{ };
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        if (!loaded.at(i)) {
+            std::cerr << "[FAIL] Can't load file '" + files.at(i) + "' as image" << std::endl;
+            return 2;
+        }
+        tile.w = std::max(tile.w, images.at(i).width());
+        tile.h = std::max(tile.h, images.at(i).height());
+    }
+    for (auto const& sprite : spritemap) {
+        auto const it = std::find(files.begin(), files.end(), sprite.second);
+        sprites[sprite.first] = images.at(static_cast<std::size_t>(it - files.begin()));
+    }
+    // colors fill whole tiles
+    for (auto const& color : colormap) {
+        if (sprites.find(color.first) == sprites.end()) {
+            auto image = niu::Image::make_image(tile.w, tile.h);
+            image.fill(color.second);
+            sprites[color.first] = image;
+        }
+    }
+
+    niu::Image image;
+    try {
+        image = niu::render_tilemap(rows, sprites);
+    } catch (std::exception const& e) {
+        std::cerr << "[FAIL] " << e.what() << std::endl;
+        return 1;
+    }
+    if (!image.save(output, niu::Format::png, options)) {
+        std::cout << "[FAIL] Can't create file '" << output << "'" << std::endl;
+        return 1;
+    }
+    std::cout << "[ OK ] File '" << output << "' generated" << std::endl;
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+struct Tile
+{
+    std::string name;
+    std::size_t x;
+    std::size_t y;
+    std::size_t w;
+    std::size_t h;
+};
+
+// ----------------------------------------------------------------------------
+// splits a CSV line, fields may be quoted with '"' ('""' inside quotes)
+std::vector<std::string>
+split_csv(
+        std::string const& line)
+{
+    std::vector<std::string> res(1);
+    bool quoted = false;
+    for (std::size_t i = 0; i < line.size(); ++i) {
+        char const c = line.at(i);
+        if (quoted) {
+            if (c != '"') {
+                res.back() += c;
+            } else if (i + 1 < line.size() && line.at(i + 1) == '"') {
+                res.back() += c;
+                ++i;
+            } else {
+                quoted = false;
+            }
+        } else if (c == '"') {
+            quoted = true;
+        } else if (c == ',') {
+            res.emplace_back();
+        } else if (c != '\r') {
+            res.back() += c;
+        }
+    }
+    return res;
+}
+
+// ----------------------------------------------------------------------------
+// 'name,x,y,width,height' lines as written by atlas, the header is optional
+bool
+read_tiles(
+        std::string const& file,
+        std::vector<Tile>& tiles)
+{
+    std::ifstream in(file);
+    if (!in.is_open()) {
+        return false;
+    }
+    std::string line;
+    for (bool first = true; std::getline(in, line); first = false) {
+        auto const fields = split_csv(line);
+        if (line.empty() || (first && fields.at(0) == "name")) {
+            continue;
+        }
+        if (fields.size() != 5) {
+            return false;
+        }
+        Tile tile{ fields.at(0), 0, 0, 0, 0 };
+        std::stringstream ss(fields.at(1) + " " + fields.at(2) + " "
+                             + fields.at(3) + " " + fields.at(4));
+        if (!(ss >> tile.x >> tile.y >> tile.w >> tile.h)) {
+            return false;
+        }
+        // sprites are named after their files
+        tile.name = niu::utils::_file_name(tile.name);
+        auto const dot = tile.name.find_last_of('.');
+        if (dot != std::string::npos && dot != 0) {
+            tile.name.erase(dot);
+        }
+        tiles.push_back(tile);
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+bool
+is_transparent(
+        niu::ImageView const& view)
+{
+    for (std::size_t y = 0; y < view.height(); ++y) {
+        unsigned char const* row = view.row(y);
+        for (std::size_t x = 0; x < view.width(); ++x) {
+            if (row[x * niu::Image::channels + 3] != 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+int
+process_slice(
+        niu::Vector2 const& size,
+        std::vector<Tile> const& manifest,
+        bool skip_empty,
+        std::size_t jobs,
+        niu::EncodeOptions const& options,
+        std::string const& input,
+        std::string const& output,
+        std::string& message)
+{
+    if (!niu::utils::_is_file_exists(input)) {
+        message = "[FAIL] Input file '" + input + "' not found";
+        return 1;
+    }
+
+    niu::Image image;
+    if (!image.load(input)) {
+        message = "[FAIL] Can't load file '" + input + "' as image";
+        return 2;
+    }
+
+    // grid tiles are named 'COLUMN_ROW', edge tiles are cut short
+    std::vector<Tile> tiles = manifest;
+    if (tiles.empty()) {
+        for (std::size_t y = 0; y < image.height(); y += size.h) {
+            for (std::size_t x = 0; x < image.width(); x += size.w) {
+                auto const name = std::to_string(x / size.w) + "_" + std::to_string(y / size.h);
+                tiles.push_back(Tile{ name, x, y, std::min(size.w, image.width() - x),
+                                      std::min(size.h, image.height() - y) });
+            }
+        }
+    }
+
+    for (auto const& tile : tiles) {
+        if (tile.x > image.width() || tile.w > image.width() - tile.x
+                || tile.y > image.height() || tile.h > image.height() - tile.y) {
+            message = "[FAIL] Tile '" + tile.name + "' is out of image '" + input + "'";
+            return 1;
+        }
+    }
+
+    // views share the pixels, tiles are only copied by the encoder; tiles
+    // are saved in parallel, each one on a single thread
+    auto tile_options = options;
+    tile_options.threads = 1;
+    std::vector<int> saved(tiles.size(), 0);
+    niu::parallel_for(tiles.size(), jobs, [&] (std::size_t i)
+    {
+        auto const& tile = tiles.at(i);
+        auto const view = image.view(tile.x, tile.y, tile.w, tile.h);
+        if (skip_empty && is_transparent(view)) {
+            return;
+        }
+        saved.at(i) = view.save(suffixed_path(output, "{tile}", tile.name),
+                                niu::Format::png, tile_options) ? 1 : -1;
+    });
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < saved.size(); ++i) {
+        if (saved.at(i) < 0) {
+            message = "[FAIL] Can't save file '"
+                    + suffixed_path(output, "{tile}", tiles.at(i).name) + "'";
+            return 1;
+        }
+        count += static_cast<std::size_t>(saved.at(i));
+    }
+
+    message = "[ OK ] File '" + input + "': " + std::to_string(count) + " tile(s) saved";
+    if (count != tiles.size()) {
+        message += ", " + std::to_string(tiles.size() - count) + " empty skipped";
+    }
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+std::string
+csv_string(
+        std::string const& str)
+{
+    if (str.find_first_of(",\"\r\n") == std::string::npos) {
+        return str;
+    }
+    std::string res = "\"";
+    for (auto c : str) {
+        if (c == '"') {
+            res += '"';
+        }
+        res += c;
+    }
+    return res + "\"";
+}
+
+// ----------------------------------------------------------------------------
+// CSV for '.csv' files, JSON otherwise
+bool
+write_manifest(
+        std::string const& file,
+        std::string const& image,
+        niu::Image const& atlas,
+        std::vector<std::string> const& names,
+        std::vector<niu::Vector2> const& positions,
+        std::vector<niu::Image> const& sprites)
+{
+    std::ofstream out(file);
+    if (!out.is_open()) {
+        return false;
+    }
+    bool const csv = file.size() >= 4 && file.compare(file.size() - 4, 4, ".csv") == 0;
+    if (csv) {
+        out << "name,x,y,width,height\n";
+    } else {
+        out << "{\n  \"image\": " << json_string(image)
+            << ",\n  \"width\": " << atlas.width()
+            << ",\n  \"height\": " << atlas.height()
+            << ",\n  \"sprites\": [";
+    }
+    for (std::size_t i = 0; i < names.size(); ++i) {
+        auto const& pos = positions.at(i);
+        auto const& sprite = sprites.at(i);
+        if (csv) {
+            out << csv_string(names.at(i)) << "," << pos.x << "," << pos.y << ","
+                << sprite.width() << "," << sprite.height() << "\n";
+        } else {
+            out << (i == 0 ? "\n" : ",\n") << "    { \"name\": " << json_string(names.at(i))
+                << ", \"x\": " << pos.x << ", \"y\": " << pos.y
+                << ", \"width\": " << sprite.width()
+                << ", \"height\": " << sprite.height() << " }";
+        }
+    }
+    if (!csv) {
+        out << "\n  ]\n}\n";
+    }
+    out.close();
+    return !out.fail();
+}
+
+// ----------------------------------------------------------------------------
+int
+process_atlas(
+        std::vector<std::string> const& inputs,
+        std::size_t jobs,
+        std::size_t width,
+        std::size_t padding,
+        std::string manifest,
+        niu::EncodeOptions const& options,
+        std::string const& output)
+{
+    std::vector<niu::Image> sprites(inputs.size());
+    std::vector<char> loaded(inputs.size(), 0);
+    niu::parallel_for(inputs.size(), jobs, [&] (std::size_t i)
+    {
+        loaded.at(i) = niu::utils::_is_file_exists(inputs.at(i))
+                && sprites.at(i).load(inputs.at(i));
+    });
+    for (std::size_t i = 0; i < inputs.size(); ++i) {
+        if (!loaded.at(i)) {
+            std::cerr << "[FAIL] Can't load file '" + inputs.at(i) + "' as image" << std::endl;
+            return 2;
+        }
+    }
+
+    std::vector<niu::Vector2> positions;
+    niu::Image atlas;
+    try {
+        atlas = niu::make_atlas(sprites, width, padding, positions);
+    } catch (std::exception const& e) {
+        std::cerr << "[FAIL] " << e.what() << std::endl;
+        return 1;
+    }
+    if (!atlas.save(output, niu::Format::png, options)) {
+        std::cerr << "[FAIL] Can't save file '" + output + "'" << std::endl;
+        return 1;
+    }
+
+    if (manifest.empty()) {
+        auto const dot = output.find_last_of('.');
+        auto const slash = output.find_last_of("/\\");
+        bool const ext = dot != std::string::npos && (slash == std::string::npos || dot > slash);
+        manifest = (ext ? output.substr(0, dot) : output) + ".json";
+    }
+    if (!write_manifest(manifest, niu::utils::_file_name(output), atlas,
+                        inputs, positions, sprites)) {
+        std::cerr << "[FAIL] Can't write manifest '" + manifest + "'" << std::endl;
+        return 1;
+    }
+
+    std::cout << "[ OK ] File '" << output << "' saved: " << inputs.size() << " sprite(s), "
+              << atlas.width() << "x" << atlas.height() << std::endl;
+    return 0;
+}
+}  // namespace
+
 int
 main(int argc,
         char const* const argv[],
@@ -15,11 +712,21 @@ main(int argc,
 {
     auto parent = argparse::ArgumentParser()
             .add_help(false);
-    parent.add_argument("-i", "--input")
+    auto& mutex_in = parent.add_mutually_exclusive_group()
+            .required(true);
+    mutex_in.add_argument("-i", "--input")
+            .metavar("FILE")
+            .type<std::string>()
+            .help("input image file, directory or glob pattern");
+    mutex_in.add_argument("-l", "--list")
             .metavar("FILE")
-            .required(true)
             .type<std::string>()
-            .help("input image file");
+            .help("file with input image paths, one per line");
+    parent.add_argument("-j", "--jobs")
+            .metavar("N")
+            .default_value("0")
+            .type<std::size_t>()
+            .help("number of files processed in parallel (0 - all cores)");
 
     auto& mutex_out = parent.add_mutually_exclusive_group()
             .required(true);
@@ -27,11 +734,54 @@ main(int argc,
             .metavar("FILE")
             .default_value("output.png")
             .type<std::string>()
-            .help("output image file");
+            .help("output image file, or output directory / '{dir}/{name}.png'"
+                  " template for multiple inputs; pyramid levels get '_N' suffix"
+                  " or replace '{level}', slice tiles '_COLUMN_ROW' or '{tile}'");
     mutex_out.add_argument("--overwrite")
             .action("store_true")
             .help("overwrite input file");
 
+    auto encoder = argparse::ArgumentParser()
+            .add_help(false);
+    encoder.add_argument("--level")
+            .metavar("N")
+            .default_value("-1")
+            .type<int>()
+            .choices({ "-1", "0", "1", "2", "3", "4", "5", "6", "7", "8", "9" })
+            .help("PNG compression level (-1 - zlib default)");
+    encoder.add_argument("--filter")
+            .default_value("adaptive")
+            .type<niu::RowFilter>()
+            .choices({ "adaptive", "none", "sub", "up", "average", "paeth" })
+            .help("PNG row filter");
+    encoder.add_argument("--strategy")
+            .default_value("auto")
+            .type<niu::Strategy>()
+            .choices({ "auto", "default", "filtered", "huffman", "rle", "fixed" })
+            .help("zlib compression strategy");
+    encoder.add_argument("--palette")
+            .action("store_true")
+            .help("write indexed PNG when image has at most 256 colors");
+    encoder.add_argument("--threads")
+            .metavar("N")
+            .default_value("1")
+            .type<std::size_t>()
+            .help("number of threads per image for processing and PNG compression"
+                  " (0 - all cores)");
+
+    auto tiled = argparse::ArgumentParser()
+            .add_help(false);
+    tiled.add_argument("--ram-budget")
+            .metavar("MIB")
+            .default_value("0")
+            .type<std::size_t>()
+            .help("keep image as tiles, in an unlinked scratch file when larger than"
+                  " that (0 - whole image in memory)");
+    tiled.add_argument("--scratch-dir")
+            .metavar("DIR")
+            .type<std::string>()
+            .help("directory for scratch file (TMPDIR or /tmp if not set)");
+
     auto parser = argparse::ArgumentParser(argc, argv, envp)
             .description("niu - niu image utility")
             .allow_abbrev(false)
@@ -44,35 +794,145 @@ main(int argc,
     auto& subparser = parser.add_subparsers()
             .dest("cmd").required(true);
     subparser.add_parser("create")
+            .parents(encoder)
+            .parents(tiled)
             .help("create image")
             .add_argument(argparse::Argument("name").help("image name"))
             .add_argument(argparse::Argument("--size").nargs(1).metavar("'W H'")
                             .required(true).help("image size"));
     subparser.add_parser("pattern")
+            .parents(encoder)
             .help("create image from pattern")
             .add_argument(argparse::Argument("name").help("image name"))
-            .add_argument(argparse::Argument("-m", "--map").action("append").required(true)
+            .add_argument(argparse::Argument("-m", "--map").action("append")
                             .one_or_more().metavar("'S=RRGGBBAA'").help("symbol to color map"))
-            .add_argument(argparse::Argument("-r", "--row").action("append").required(true)
-                            .one_or_more().help("image row"));
+            .add_argument(argparse::Argument("-s", "--sprite").action("append")
+                            .one_or_more().metavar("'S=FILE'")
+                            .help("symbol to sprite image map, symbols become tiles of the"
+                                  " largest sprite size"))
+            .add_argument(argparse::Argument("-r", "--row").action("append")
+                            .one_or_more().help("image row"))
+            .add_argument(argparse::Argument("--rows").metavar("FILE")
+                            .help("file with image rows, one per line"));
     subparser.add_parser("upscale")
             .parents(parent)
+            .parents(encoder)
             .help("upscale image")
             .add_argument(argparse::Argument("n").help("upscale multiplier"));
+    subparser.add_parser("resize")
+            .parents(parent)
+            .parents(encoder)
+            .help("resize image to arbitrary size")
+            .add_argument(argparse::Argument("--size").required(true).metavar("'W H'")
+                            .help("new size, 0 for one side keeps the aspect ratio"))
+            .add_argument(argparse::Argument("-k", "--kernel").default_value("lanczos")
+                            .choices({ "box", "bilinear", "bicubic", "lanczos" })
+                            .help("resampling filter"));
+    subparser.add_parser("inverse_x")
+            .parents(parent)
+            .parents(encoder)
+            .help("mirror image horizontally");
+    subparser.add_parser("inverse_y")
+            .parents(parent)
+            .parents(encoder)
+            .help("mirror image vertically");
+    subparser.add_parser("transpose")
+            .parents(parent)
+            .parents(encoder)
+            .help("swap rows and columns of image");
+    subparser.add_parser("rotate")
+            .parents(parent)
+            .parents(encoder)
+            .help("rotate image clockwise")
+            .add_argument(argparse::Argument("angle").choices({ "90", "180", "270" })
+                            .help("angle in degrees"));
+    subparser.add_parser("crop")
+            .parents(parent)
+            .parents(encoder)
+            .help("crop image, decoding only the rows it needs")
+            .add_argument(argparse::Argument("-p", "--position").required(true).metavar("'X Y'")
+                            .help("top left corner of region"))
+            .add_argument(argparse::Argument("--size").required(true).metavar("'W H'")
+                            .help("region size, 0 - up to the edge"));
+    subparser.add_parser("pyramid")
+            .parents(parent)
+            .parents(encoder)
+            .help("save half size levels of image down to 1x1")
+            .add_argument(argparse::Argument("-n", "--levels").metavar("N").default_value("0")
+                            .help("number of levels (0 - all)"))
+            .add_argument(argparse::Argument("-k", "--kernel").default_value("box")
+                            .choices({ "box", "bilinear", "bicubic", "lanczos" })
+                            .help("resampling filter"));
+    subparser.add_parser("slice")
+            .parents(parent)
+            .parents(encoder)
+            .help("cut image into tiles, saved in parallel")
+            .add_argument(argparse::Argument("--size").metavar("'W H'").default_value("0 0")
+                            .help("tile size, edge tiles may be smaller"))
+            .add_argument(argparse::Argument("-m", "--manifest").metavar("FILE")
+                            .help("CSV file with 'name,x,y,width,height' tiles instead of"
+                                  " a grid, as written by atlas"))
+            .add_argument(argparse::Argument("--skip-empty").action("store_true")
+                            .help("don't save fully transparent tiles"));
+    subparser.add_parser("atlas")
+            .parents(parent)
+            .parents(encoder)
+            .help("pack images into one texture atlas")
+            .add_argument(argparse::Argument("-w", "--width").metavar("N").default_value("0")
+                            .help("atlas width (0 - smallest power of two that fits)"))
+            .add_argument(argparse::Argument("--padding").metavar("N").default_value("0")
+                            .help("transparent pixels between sprites"))
+            .add_argument(argparse::Argument("-m", "--manifest").metavar("FILE")
+                            .help("sprite coordinates, CSV for '.csv' files, JSON otherwise"
+                                  " (default - output with '.json')"));
     subparser.add_parser("merge")
             .parents(parent)
+            .parents(encoder)
+            .parents(tiled)
             .add_argument(argparse::Argument("-m", "--merge").required(true).help("image to merge"))
-            .add_argument(argparse::Argument("-p", "--position").required(true).help("offset position"));
+            .add_argument(argparse::Argument("-p", "--position").required(true).metavar("'X Y'")
+                            .help("offset position, may be negative"))
+            .add_argument(argparse::Argument("--mode").default_value("mask")
+                            .choices({ "mask", "copy", "over", "multiply", "add", "screen" })
+                            .help("blend mode"));
     subparser.add_parser("fill")
             .parents(parent)
+            .parents(encoder)
+            .parents(tiled)
             .help("fill image")
             .add_argument(argparse::Argument("color").metavar("RRGGBBAA").help("color value in hex"));
     subparser.add_parser("set_color")
             .parents(parent)
+            .parents(encoder)
+            .parents(tiled)
             .help("set color at positions in image")
             .add_argument(argparse::Argument("color").metavar("RRGGBBAA").help("color value in hex"))
-            .add_argument(argparse::Argument("-p", "--positions").action("append").required(true)
-                            .one_or_more().metavar("'X Y'").help("positions"));
+            .add_argument(argparse::Argument("-p", "--positions").action("append")
+                            .one_or_more().metavar("'X Y'").help("positions"))
+            .add_argument(argparse::Argument("-f", "--file").metavar("FILE")
+                            .help("text file with 'X Y [RRGGBBAA]' lines (a line with only a"
+                                  " color switches it) or binary points file"));
+    subparser.add_parser("pipeline")
+            .parents(parent)
+            .parents(encoder)
+            .help("apply chain of operations with single load and save")
+            .add_argument(argparse::Argument("-s", "--step").action("append")
+                            .metavar("'OP ARGS'").help("operation, e.g. 'upscale 2', 'resize W H [KERNEL]', "
+                                                       "'fill RRGGBBAA', "
+                                                       "'set_color RRGGBBAA X Y ...', "
+                                                       "'set_colors FILE [RRGGBBAA]', "
+                                                       "'merge FILE X Y [MODE]', "
+                                                       "'inverse_x', 'inverse_y', 'transpose', 'rotate 90'"))
+            .add_argument(argparse::Argument("-r", "--recipe").metavar("FILE")
+                            .help("file with operations, one per line"));
+    subparser.add_parser("info")
+            .help("print image size, channels and bit depth without decoding")
+            .add_argument(argparse::Argument("files").one_or_more()
+                            .help("image files, directories or glob patterns"))
+            .add_argument(argparse::Argument("-j", "--jobs").metavar("N").default_value("0")
+                            .help("number of files probed in parallel (0 - all cores)"))
+            .add_argument(argparse::Argument("--json").action("store_true")
+                            .help("print as JSON array"));
     subparser.add_parser("dump")
             .parents(parent)
             .help("dump image");
@@ -85,14 +945,40 @@ main(int argc,
     auto const args = parser.parse_args();
 
     auto const command = args.get<std::string>("cmd");
+    if (command == "info") {
+        return print_info(args.get<std::vector<std::string> >("files"),
+                          args.get<std::size_t>("jobs"), args.get<bool>("json"));
+    }
+
+    if (command != "dump") {
+        niu::set_threads(args.get<std::size_t>("threads"));
+    }
 
     if (command == "create") {
         auto const output = args.get<std::string>("name");
         auto const size = args.get<niu::Vector2>("size");
 
-        auto image = niu::Image::make_image(size.w, size.h);
+        auto const ram_budget = args.get<std::size_t>("ram_budget");
+        if (ram_budget != 0) {
+            try {
+                niu::TiledImage image(size.w, size.h, ram_budget << 20,
+                                      args.get<std::string>("scratch_dir"));
+                if (!image.save(output, niu::Format::png, encode_options(args))) {
+                    std::cout << "[FAIL] Can't create file '" << output << "'" << std::endl;
+                    return 1;
+                }
+            } catch (std::exception const& e) {
+                std::cerr << "[FAIL] " << e.what() << std::endl;
+                return 1;
+            }
+            std::cout << "[ OK ] File '" << output << "' generated" << std::endl;
+            return 0;
+        }
 
-        if (!image.save(output)) {
+        std::vector<unsigned char> const row(size.w * niu::Image::channels, 0);
+        if (!niu::Image::save_rows(output, size.w, size.h,
+                                   [&row] (std::size_t, unsigned char*)
+        { return row.data(); }, niu::Format::png, encode_options(args))) {
             std::cout << "[FAIL] Can't create file '" << output << "'" << std::endl;
             return 1;
         }
@@ -103,7 +989,28 @@ main(int argc,
     if (command == "pattern") {
         auto const output = args.get<std::string>("name");
         auto const colormap = args.get<std::map<char, niu::Color> >("map");
-        auto const rows = args.get<std::vector<std::string> >("row");
+        auto const spritemap = args.get<std::map<char, std::string> >("sprite");
+        auto rows = args.get<std::vector<std::string> >("row");
+        auto const rows_file = args.get<std::string>("rows");
+        if (!rows_file.empty() && !read_rows(rows_file, rows)) {
+            std::cerr << "[FAIL] Can't read rows '" + rows_file + "'" << std::endl;
+            return 1;
+        }
+        if (rows.empty()) {
+            std::cerr << "[FAIL] Pattern needs rows (-r or --rows)" << std::endl;
+            return 1;
+        }
+        if (!spritemap.empty()) {
+            return render_pattern(output, rows, colormap, spritemap, encode_options(args));
+        }
+        for (auto const& row : rows) {
+            for (auto const symbol : row) {
+                if (symbol != ' ' && colormap.find(symbol) == colormap.end()) {
+                    std::cerr << "[FAIL] Unknown symbol '" << symbol << "'" << std::endl;
+                    return 1;
+                }
+            }
+        }
 
         niu::Vector2 size;
         size.h = rows.size();
@@ -114,20 +1021,25 @@ main(int argc,
             }
         }
 
-        auto image = niu::Image::make_image(size.w, size.h);
-        image.fill(niu::Color{ });
-
-        for (std::size_t y = 0; y < rows.size(); ++y) {
-            for (std::size_t x = 0; x < rows.at(y).size(); ++x) {
-                auto symbol = rows.at(y).at(x);
-                if (symbol != ' ') {
-                    auto color = colormap.at(symbol);
-                    image.set_color(x, y, color);
+        if (!niu::Image::save_rows(output, size.w, size.h,
+                                   [&] (std::size_t y, unsigned char* buffer)
+        {
+            auto const& row = rows.at(y);
+            // runs of one symbol are filled at once
+            for (std::size_t x = 0, run = 0; x < size.w; x += run) {
+                auto const symbol = x < row.size() ? row.at(x) : ' ';
+                run = 1;
+                while (x + run < row.size() && row.at(x + run) == symbol) {
+                    ++run;
+                }
+                if (x >= row.size()) {
+                    run = size.w - x;
                 }
+                niu::kernels::fill(buffer + x * niu::Image::channels, run,
+                                   symbol != ' ' ? colormap.at(symbol) : niu::Color{ });
             }
-        }
-
-        if (!image.save(output)) {
+            return buffer;
+        }, niu::Format::png, encode_options(args))) {
             std::cout << "[FAIL] Can't create file '" << output << "'" << std::endl;
             return 1;
         }
@@ -135,38 +1047,66 @@ main(int argc,
         return 0;
     }
 
-    auto const input = args.get<std::string>("input");
-    auto output = args.get<std::string>("o");
-    if (args.get<bool>("overwrite")) {
-        output = input;
+    niu::Pipeline pipeline;
+
+    if (command == "upscale") {
+        auto const n = args.get<std::size_t>("n");
+        if (n == 0) {
+            std::cerr << "[FAIL] Invalid upscale multiplier '0'" << std::endl;
+            return 1;
+        }
+        pipeline.add_upscale(n);
     }
 
-    if (!niu::utils::_is_file_exists(input)) {
-        std::cerr << "[FAIL] Input file '" + input + "' not found" << std::endl;
-        return 1;
+    if (command == "resize") {
+        auto const size = args.get<niu::Vector2>("size");
+        auto const kernel = args.get<niu::ResampleFilter>("kernel");
+        if (size.w == 0 && size.h == 0) {
+            std::cerr << "[FAIL] Invalid size '0 0'" << std::endl;
+            return 1;
+        }
+        pipeline.add_resize(size.w, size.h, kernel);
     }
 
-    niu::Image image;
-    if (!image.load(input)) {
-        std::cerr << "[FAIL] Can't load file '" + input + "' as image" << std::endl;
-        return 2;
+    if (command == "inverse_x") {
+        pipeline.add_inverse_x();
     }
 
-    if (command == "upscale") {
-        auto const n = args.get<std::size_t>("n");
-        image.upscale(n);
+    if (command == "inverse_y") {
+        pipeline.add_inverse_y();
+    }
+
+    if (command == "transpose") {
+        pipeline.add_transpose();
+    }
+
+    if (command == "rotate") {
+        pipeline.add_rotate(args.get<int>("angle"));
     }
 
     if (command == "fill") {
         auto const color = args.get<niu::Color>("color");
-        image.fill(color);
+        pipeline.add_fill(color);
     }
 
     if (command == "set_color") {
         auto const color = args.get<niu::Color>("color");
         auto const positions = args.get<std::vector<niu::Vector2> >("positions");
-        for (auto const& pos : positions) {
-            image.set_color(pos.x, pos.y, color);
+        auto const file = args.get<std::string>("file");
+        if (positions.empty() && file.empty()) {
+            std::cerr << "[FAIL] Set color needs positions (-p or -f)" << std::endl;
+            return 1;
+        }
+        if (!positions.empty()) {
+            pipeline.add_set_color(color, positions);
+        }
+        if (!file.empty()) {
+            std::vector<niu::ColorPoint> points;
+            if (!niu::utils::_is_file_exists(file) || !niu::read_points(file, color, points)) {
+                std::cerr << "[FAIL] Can't read points file '" + file + "'" << std::endl;
+                return 1;
+            }
+            pipeline.add_set_colors(points);
         }
     }
 
@@ -183,21 +1123,143 @@ main(int argc,
             return 2;
         }
 
-        auto const offset = args.get<niu::Vector2>("position");
+        auto const offset = args.get<niu::Point>("position");
+        auto const mode = args.get<niu::BlendMode>("mode");
+        pipeline.add_merge(image2, offset, mode);
+    }
 
-        image.merge(image2, offset);
+    if (command == "pipeline") {
+        auto const recipe = args.get<std::string>("recipe");
+        auto const steps = args.get<std::vector<std::string> >("step");
+        try {
+            if (!recipe.empty() && !pipeline.load_recipe(recipe)) {
+                std::cerr << "[FAIL] Can't read recipe '" + recipe + "'" << std::endl;
+                return 1;
+            }
+            for (auto const& step : steps) {
+                pipeline.add_step(step);
+            }
+        } catch (std::exception const& e) {
+            std::cerr << "[FAIL] " << e.what() << std::endl;
+            return 1;
+        }
     }
 
-    if (command == "dump") {
-        if (!image.dump(output)) {
-            std::cout << "[FAIL] Can't dump to file '" << output << "'" << std::endl;
+    auto const input = args.get<std::string>("input");
+    auto const list = args.get<std::string>("list");
+    auto const output = args.get<std::string>("o");
+    auto const overwrite = args.get<bool>("overwrite");
+    auto const options = command == "dump" ? niu::EncodeOptions()
+                                           : encode_options(args);
+
+    niu::Vector2 tile_size{ };
+    std::vector<Tile> tiles;
+    if (command == "slice") {
+        auto const manifest = args.get<std::string>("manifest");
+        if (!manifest.empty()) {
+            if (!read_tiles(manifest, tiles)) {
+                std::cerr << "[FAIL] Can't read manifest '" + manifest + "'" << std::endl;
+                return 1;
+            }
+        } else {
+            tile_size = args.get<niu::Vector2>("size");
+        }
+        if (tiles.empty() && (tile_size.w == 0 || tile_size.h == 0)) {
+            std::cerr << "[FAIL] Slice needs tile size or non-empty manifest" << std::endl;
             return 1;
         }
-    } else if (!image.save(output)) {
-        std::cout << "[FAIL] Can't save file '" << output << "'" << std::endl;
+    }
+
+    auto const tiled_command = command == "fill" || command == "merge"
+            || command == "set_color";
+    auto const ram_budget = tiled_command ? args.get<std::size_t>("ram_budget") : 0;
+
+    // a batch already spreads files over -j workers, a single file spreads
+    // its tiles or pyramid levels over all cores instead
+    auto const single = list.empty() && !niu::is_batch_input(input);
+    std::size_t const part_jobs = single ? 0 : 1;
+
+    auto const process = [&] (std::string const& file, std::string const& out,
+                              std::string& message)
+    {
+        if (command == "crop") {
+            return process_crop(args.get<niu::Point>("position"),
+                                args.get<niu::Vector2>("size"),
+                                options, file, out, message);
+        }
+        if (command == "slice") {
+            return process_slice(tile_size, tiles, args.get<bool>("skip_empty"),
+                                 part_jobs, options, file, out, message);
+        }
+        if (command == "pyramid") {
+            return process_pyramid(args.get<std::size_t>("levels"),
+                                   args.get<niu::ResampleFilter>("kernel"),
+                                   part_jobs, options, file, out, message);
+        }
+        if (ram_budget != 0) {
+            return process_tiled(command, pipeline, ram_budget << 20,
+                                 args.get<std::string>("scratch_dir"),
+                                 options, file, out, message);
+        }
+        return process_file(command, pipeline, options, file, out, message);
+    };
+
+    if (command != "atlas" && single) {
+        std::string message;
+        int const res = process(input, overwrite ? input : output, message);
+        (res == 0 ? std::cout : std::cerr) << message << std::endl;
+        return res;
+    }
+
+    std::vector<std::string> inputs;
+    if (!list.empty()) {
+        if (!niu::read_input_list(list, inputs)) {
+            std::cerr << "[FAIL] Can't read input list '" + list + "'" << std::endl;
+            return 1;
+        }
+    } else {
+        inputs = niu::expand_input(input);
+    }
+    if (inputs.empty()) {
+        std::cerr << "[FAIL] No input files found" << std::endl;
         return 1;
     }
 
-    std::cout << "[ OK ] File '" << output << "' saved" << std::endl;
-    return 0;
+    if (command == "atlas") {
+        if (overwrite) {
+            std::cerr << "[FAIL] Atlas needs output file" << std::endl;
+            return 1;
+        }
+        return process_atlas(inputs, args.get<std::size_t>("jobs"),
+                             args.get<std::size_t>("width"), args.get<std::size_t>("padding"),
+                             args.get<std::string>("manifest"), options, output);
+    }
+
+    // files are written concurrently, so no two inputs may share an output
+    auto const ext = command == "dump" ? ".txt" : ".png";
+    std::map<std::string, std::string> outputs;
+    std::map<std::string, std::string> owners;
+    for (auto const& file : inputs) {
+        auto const out = overwrite ? file
+                                   : niu::make_output_path(output, file, ext);
+        auto const owner = owners.insert(std::make_pair(out, file));
+        if (!owner.second) {
+            std::cerr << "[FAIL] Files '" << owner.first->second << "' and '" << file
+                      << "' have the same output '" << out << "'" << std::endl;
+            return 1;
+        }
+        outputs[file] = out;
+    }
+
+    auto const result = niu::run_batch(
+                inputs, args.get<std::size_t>("jobs"),
+                [&] (std::string const& file, std::string& message)
+    {
+        return process(file, outputs.at(file), message) == 0;
+    });
+
+    std::cout << "[DONE] " << inputs.size() << " file(s): "
+              << result.succeeded << " succeeded, "
+              << result.failed << " failed" << std::endl;
+    return result.failed == 0 ? 0 : 1;
 }
@@ -0,0 +1,484 @@
+#include "pipeline.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include "points.h"
+#include "utils.h"
+
+namespace niu {
+// -- Pipeline implementation -------------------------------------------------
+Pipeline::Pipeline()
+    : m_steps()
+{
+}
+
+// ----------------------------------------------------------------------------
+Pipeline::Step&
+Pipeline::push(
+        Kind kind)
+{
+    m_steps.push_back(Step{ kind, 0, Color{ }, std::vector<Vector2>(), Image(),
+                            Point{ }, BlendMode::mask, Vector2{ },
+                            ResampleFilter::lanczos, std::vector<ColorPoint>() });
+    return m_steps.back();
+}
+
+// ----------------------------------------------------------------------------
+void
+Pipeline::add_upscale(
+        std::size_t n)
+{
+    if (n == 0) {
+        throw std::invalid_argument("invalid upscale multiplier 0");
+    }
+    if (n == 1) {
+        return;
+    }
+    if (!m_steps.empty() && m_steps.back().kind == Kind::upscale) {
+        m_steps.back().n *= n;
+        return;
+    }
+    push(Kind::upscale).n = n;
+}
+
+// ----------------------------------------------------------------------------
+void
+Pipeline::add_resize(
+        std::size_t width,
+        std::size_t height,
+        ResampleFilter filter)
+{
+    if (width == 0 && height == 0) {
+        throw std::invalid_argument("invalid resize size");
+    }
+    auto& step = push(Kind::resize);
+    step.size.w = width;
+    step.size.h = height;
+    step.filter = filter;
+}
+
+// ----------------------------------------------------------------------------
+void
+Pipeline::add_fill(
+        Color color)
+{
+    // everything since the last size change is overwritten by the fill
+    while (!m_steps.empty() && m_steps.back().kind != Kind::upscale
+           && m_steps.back().kind != Kind::resize
+           && m_steps.back().kind != Kind::transpose
+           && m_steps.back().kind != Kind::rotate) {
+        m_steps.pop_back();
+    }
+    push(Kind::fill).color = color;
+}
+
+// ----------------------------------------------------------------------------
+void
+Pipeline::add_set_color(
+        Color color,
+        std::vector<Vector2> const& positions)
+{
+    if (!m_steps.empty() && m_steps.back().kind == Kind::set_color
+            && m_steps.back().color.value == color.value) {
+        auto& steps = m_steps.back().positions;
+        steps.insert(steps.end(), positions.begin(), positions.end());
+        return;
+    }
+    auto& step = push(Kind::set_color);
+    step.color = color;
+    step.positions = positions;
+}
+
+// ----------------------------------------------------------------------------
+void
+Pipeline::add_set_colors(
+        std::vector<ColorPoint> const& points)
+{
+    if (!m_steps.empty() && m_steps.back().kind == Kind::set_colors) {
+        auto& steps = m_steps.back().points;
+        steps.insert(steps.end(), points.begin(), points.end());
+        return;
+    }
+    push(Kind::set_colors).points = points;
+}
+
+// ----------------------------------------------------------------------------
+void
+Pipeline::add_merge(
+        Image const& image,
+        Point const& offset,
+        BlendMode mode)
+{
+    auto& step = push(Kind::merge);
+    step.image = image;
+    step.offset = offset;
+    step.mode = mode;
+}
+
+// ----------------------------------------------------------------------------
+void
+Pipeline::add_inverse_x()
+{
+    if (!m_steps.empty() && m_steps.back().kind == Kind::inverse_x) {
+        m_steps.pop_back();
+        return;
+    }
+    push(Kind::inverse_x);
+}
+
+// ----------------------------------------------------------------------------
+void
+Pipeline::add_inverse_y()
+{
+    if (!m_steps.empty() && m_steps.back().kind == Kind::inverse_y) {
+        m_steps.pop_back();
+        return;
+    }
+    push(Kind::inverse_y);
+}
+
+// ----------------------------------------------------------------------------
+void
+Pipeline::add_transpose()
+{
+    if (!m_steps.empty() && m_steps.back().kind == Kind::transpose) {
+        m_steps.pop_back();
+        return;
+    }
+    push(Kind::transpose);
+}
+
+// ----------------------------------------------------------------------------
+void
+Pipeline::add_rotate(
+        int degrees)
+{
+    if (degrees % 90 != 0) {
+        throw std::invalid_argument("invalid rotation angle");
+    }
+    // counted in clockwise quarter turns
+    std::size_t turns = static_cast<std::size_t>((degrees / 90 % 4 + 4) % 4);
+    if (!m_steps.empty() && m_steps.back().kind == Kind::rotate) {
+        turns = (turns + m_steps.back().n) % 4;
+        m_steps.pop_back();
+    }
+    if (turns != 0) {
+        push(Kind::rotate).n = turns;
+    }
+}
+
+// ----------------------------------------------------------------------------
+void
+Pipeline::add_step(
+        std::string const& step)
+{
+    std::stringstream ss(step);
+    std::string name;
+    ss >> name;
+    if (name == "upscale") {
+        std::size_t n = 0;
+        ss >> n;
+        if (ss.fail() || n == 0) {
+            throw std::invalid_argument("invalid upscale step: '" + step + "'");
+        }
+        add_upscale(n);
+    } else if (name == "resize") {
+        Vector2 size;
+        ss >> size;
+        if (ss.fail() || (size.w == 0 && size.h == 0)) {
+            throw std::invalid_argument("invalid resize step: '" + step + "'");
+        }
+        ResampleFilter filter = ResampleFilter::lanczos;
+        std::string kernel;
+        if (ss >> kernel) {
+            std::stringstream kernel_ss(kernel);
+            kernel_ss >> filter;
+        }
+        add_resize(size.w, size.h, filter);
+    } else if (name == "fill") {
+        Color color;
+        ss >> color;
+        add_fill(color);
+    } else if (name == "set_color") {
+        Color color;
+        ss >> color;
+        std::vector<Vector2> positions;
+        Vector2 pos;
+        while (ss >> pos) {
+            positions.push_back(pos);
+        }
+        if (positions.empty() || !ss.eof()) {
+            throw std::invalid_argument("invalid set_color step: '" + step + "'");
+        }
+        add_set_color(color, positions);
+    } else if (name == "set_colors") {
+        std::string file;
+        ss >> file;
+        if (ss.fail()) {
+            throw std::invalid_argument("invalid set_colors step: '" + step + "'");
+        }
+        Color color;
+        color.value = 0;
+        std::string value;
+        if (ss >> value) {
+            std::stringstream color_ss(value);
+            color_ss >> color;
+        }
+        std::vector<ColorPoint> points;
+        if (!utils::_is_file_exists(file) || !read_points(file, color, points)) {
+            throw std::invalid_argument("can't read points file '" + file + "'");
+        }
+        add_set_colors(points);
+    } else if (name == "merge") {
+        std::string file;
+        Point offset;
+        ss >> file >> offset;
+        if (ss.fail()) {
+            throw std::invalid_argument("invalid merge step: '" + step + "'");
+        }
+        BlendMode mode = BlendMode::mask;
+        std::string blend;
+        if (ss >> blend) {
+            std::stringstream blend_ss(blend);
+            blend_ss >> mode;
+        }
+        Image image;
+        if (!utils::_is_file_exists(file) || !image.load(file)) {
+            throw std::invalid_argument("can't load merge image '" + file + "'");
+        }
+        add_merge(image, offset, mode);
+    } else if (name == "inverse_x") {
+        add_inverse_x();
+    } else if (name == "inverse_y") {
+        add_inverse_y();
+    } else if (name == "transpose") {
+        add_transpose();
+    } else if (name == "rotate") {
+        int degrees = 0;
+        ss >> degrees;
+        if (ss.fail() || degrees % 90 != 0) {
+            throw std::invalid_argument("invalid rotate step: '" + step + "'");
+        }
+        add_rotate(degrees);
+    } else {
+        throw std::invalid_argument("unknown pipeline step: '" + step + "'");
+    }
+}
+
+// ----------------------------------------------------------------------------
+bool
+Pipeline::load_recipe(
+        std::string const& file)
+{
+    std::ifstream in(file);
+    if (!in.is_open()) {
+        std::cerr << "Failed to open recipe: " << file << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        auto const pos = line.find_first_not_of(" \t\r");
+        if (pos == std::string::npos || line.at(pos) == '#') {
+            continue;
+        }
+        add_step(line);
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+void
+Pipeline::apply(
+        Image& image) const
+{
+    auto const n = apply_deferred(image);
+    if (n != 1) {
+        image.upscale(n);
+    }
+}
+
+// ----------------------------------------------------------------------------
+void
+Pipeline::apply(
+        AnyImage& image) const
+{
+    auto const n = apply_deferred(image);
+    if (n != 1) {
+        image.upscale(n);
+    }
+}
+
+// ----------------------------------------------------------------------------
+std::size_t
+Pipeline::apply_deferred(
+        AnyImage& image) const
+{
+    std::size_t count = m_steps.size();
+    std::size_t res = 1;
+    if (count != 0 && m_steps.back().kind == Kind::upscale) {
+        res = m_steps.back().n;
+        --count;
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        auto const& step = m_steps.at(i);
+        switch (step.kind) {
+            case Kind::upscale :
+                image.upscale(step.n);
+                break;
+            case Kind::fill :
+                image.fill(step.color);
+                break;
+            case Kind::set_color :
+                for (auto const& pos : step.positions) {
+                    image.set_color(pos.x, pos.y, step.color);
+                }
+                break;
+            case Kind::set_colors :
+                for (auto const& point : step.points) {
+                    image.set_color(point.x, point.y, point.color);
+                }
+                break;
+            case Kind::inverse_x :
+                image.inverse_x();
+                break;
+            case Kind::inverse_y :
+                image.inverse_y();
+                break;
+            default :
+                throw std::invalid_argument("step needs RGBA image");
+        }
+    }
+    return res;
+}
+
+// ----------------------------------------------------------------------------
+void
+Pipeline::apply(
+        TiledImage& image) const
+{
+    for (auto const& step : m_steps) {
+        switch (step.kind) {
+            case Kind::fill :
+                image.fill(step.color);
+                break;
+            case Kind::set_color :
+                for (auto const& pos : step.positions) {
+                    image.set_color(pos.x, pos.y, step.color);
+                }
+                break;
+            case Kind::set_colors :
+                for (auto const& point : step.points) {
+                    image.set_color(point.x, point.y, point.color);
+                }
+                break;
+            case Kind::merge :
+                image.merge(step.image, step.offset, step.mode);
+                break;
+            default :
+                throw std::invalid_argument("step needs in-memory image");
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+bool
+Pipeline::keeps_format(
+        std::size_t channels) const noexcept
+{
+    bool const alpha = channels == 2 || channels == 4;
+    bool const chroma = channels >= 3;
+    auto const fits = [alpha, chroma] (Color color)
+    {
+        return (alpha || color.a == 0xff)
+                && (chroma || (color.r == color.g && color.g == color.b));
+    };
+    for (auto const& step : m_steps) {
+        switch (step.kind) {
+            case Kind::merge :
+            case Kind::resize :
+            case Kind::transpose :
+            case Kind::rotate :
+                return false;
+            case Kind::fill :
+            case Kind::set_color :
+                if (!fits(step.color)) {
+                    return false;
+                }
+                break;
+            case Kind::set_colors :
+                for (auto const& point : step.points) {
+                    if (!fits(point.color)) {
+                        return false;
+                    }
+                }
+                break;
+            default :
+                break;
+        }
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+std::size_t
+Pipeline::apply_deferred(
+        Image& image) const
+{
+    std::size_t count = m_steps.size();
+    std::size_t res = 1;
+    if (count != 0 && m_steps.back().kind == Kind::upscale) {
+        res = m_steps.back().n;
+        --count;
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        auto const& step = m_steps.at(i);
+        switch (step.kind) {
+            case Kind::upscale :
+                image.upscale(step.n);
+                break;
+            case Kind::resize :
+                image.resize(step.size.w, step.size.h, step.filter);
+                break;
+            case Kind::fill :
+                image.fill(step.color);
+                break;
+            case Kind::set_color :
+                for (auto const& pos : step.positions) {
+                    image.set_color(pos.x, pos.y, step.color);
+                }
+                break;
+            case Kind::set_colors :
+                image.set_colors(step.points);
+                break;
+            case Kind::merge :
+                image.merge(step.image, step.offset, step.mode);
+                break;
+            case Kind::inverse_x :
+                image.inverse_x();
+                break;
+            case Kind::inverse_y :
+                image.inverse_y();
+                break;
+            case Kind::transpose :
+                image.transpose();
+                break;
+            case Kind::rotate :
+                image.rotate(static_cast<int>(step.n) * 90);
+                break;
+            default :
+                break;
+        }
+    }
+    return res;
+}
+
+// ----------------------------------------------------------------------------
+std::size_t
+Pipeline::size() const noexcept
+{
+    return m_steps.size();
+}
+}  // namespace niu
@@ -0,0 +1,275 @@
+#include "points.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#if __cplusplus >= 201703L
+#include <charconv>
+#endif  // C++17
+
+#include "endian.h"
+#include "io.h"
+#include "parallel.h"
+
+namespace niu {
+namespace {
+// ----------------------------------------------------------------------------
+// text chunks smaller than that are not worth a worker
+std::size_t const min_chunk_size = std::size_t(1) << 16;
+
+// ----------------------------------------------------------------------------
+inline bool
+is_separator(char c)
+{
+    return c == ' ' || c == '\t' || c == ',' || c == '\r';
+}
+
+// ----------------------------------------------------------------------------
+bool
+parse_number(
+        char const* begin,
+        char const* end,
+        std::size_t& value)
+{
+#if __cplusplus >= 201703L
+    auto const res = std::from_chars(begin, end, value);
+    return res.ec == std::errc() && res.ptr == end;
+#else
+    if (begin == end) {
+        return false;
+    }
+    std::size_t res = 0;
+    for (; begin != end; ++begin) {
+        unsigned const digit = static_cast<unsigned>(*begin - '0');
+        if (digit > 9 || res > (static_cast<std::size_t>(-1) - digit) / 10) {
+            return false;
+        }
+        res = res * 10 + digit;
+    }
+    value = res;
+    return true;
+#endif  // C++17
+}
+
+// ----------------------------------------------------------------------------
+// RRGGBB or RRGGBBAA, as operator >>(std::istream&, Color&)
+bool
+parse_color(
+        char const* begin,
+        char const* end,
+        Color& color)
+{
+    std::size_t const size = static_cast<std::size_t>(end - begin);
+    if (size != 6 && size != 8) {
+        return false;
+    }
+    uint32_t value = 0;
+#if __cplusplus >= 201703L
+    auto const res = std::from_chars(begin, end, value, 16);
+    if (res.ec != std::errc() || res.ptr != end) {
+        return false;
+    }
+#else
+    for (; begin != end; ++begin) {
+        char const c = *begin;
+        uint32_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = static_cast<uint32_t>(c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            digit = static_cast<uint32_t>(c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            digit = static_cast<uint32_t>(c - 'A' + 10);
+        } else {
+            return false;
+        }
+        value = value << 4 | digit;
+    }
+#endif  // C++17
+    if (size == 6) {
+        value = value << 8 | 0xff;
+    }
+    color.value = ntohl(value);
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// Points of one piece of a text file. Points before its first color line
+// that have no color of their own take the color in effect at the start of
+// the piece, which is only known once the previous pieces are parsed.
+struct Chunk
+{
+    std::vector<ColorPoint> points = std::vector<ColorPoint>();
+    std::vector<std::size_t> inherit = std::vector<std::size_t>();
+    bool has_color = false;
+    Color color = Color{ };
+    // offset of the first invalid line, or the chunk end
+    std::size_t error = 0;
+};
+
+// ----------------------------------------------------------------------------
+void
+parse_chunk(
+        char const* data,
+        std::size_t begin,
+        std::size_t end,
+        Chunk& chunk)
+{
+    chunk.error = end;
+    std::size_t pos = begin;
+    while (pos < end) {
+        std::size_t const line = pos;
+        // up to 3 tokens
+        char const* tokens[3][2];
+        std::size_t count = 0;
+        while (pos < end && data[pos] != '\n' && data[pos] != '#') {
+            if (is_separator(data[pos])) {
+                ++pos;
+                continue;
+            }
+            std::size_t const from = pos;
+            while (pos < end && data[pos] != '\n' && data[pos] != '#'
+                   && !is_separator(data[pos])) {
+                ++pos;
+            }
+            if (count == 3) {
+                chunk.error = line;
+                return;
+            }
+            tokens[count][0] = data + from;
+            tokens[count][1] = data + pos;
+            ++count;
+        }
+        while (pos < end && data[pos] != '\n') {
+            ++pos;
+        }
+        ++pos;
+
+        ColorPoint point{ 0, 0, Color{ } };
+        bool valid = true;
+        if (count == 1) {
+            valid = parse_color(tokens[0][0], tokens[0][1], chunk.color);
+            chunk.has_color = true;
+        } else if (count >= 2) {
+            valid = parse_number(tokens[0][0], tokens[0][1], point.x)
+                    && parse_number(tokens[1][0], tokens[1][1], point.y);
+            if (count == 3) {
+                valid = valid && parse_color(tokens[2][0], tokens[2][1], point.color);
+            } else if (chunk.has_color) {
+                point.color = chunk.color;
+            } else {
+                chunk.inherit.push_back(chunk.points.size());
+            }
+            if (valid) {
+                chunk.points.push_back(point);
+            }
+        }
+        if (!valid) {
+            chunk.error = line;
+            return;
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+bool
+read_binary(
+        unsigned char const* data,
+        std::size_t size,
+        std::vector<ColorPoint>& points)
+{
+    std::size_t const header = sizeof(points_magic) - 1;
+    std::size_t const record = 12;
+    if ((size - header) % record != 0) {
+        return false;
+    }
+    std::size_t const count = (size - header) / record;
+    std::size_t const offset = points.size();
+    points.resize(offset + count);
+    data += header;
+    parallel_bands(count, [&] (std::size_t begin, std::size_t end)
+    {
+        for (std::size_t i = begin; i < end; ++i) {
+            unsigned char const* from = data + i * record;
+            uint32_t x, y;
+            std::memcpy(&x, from, 4);
+            std::memcpy(&y, from + 4, 4);
+            auto& point = points.at(offset + i);
+            point.x = ntohl(x);
+            point.y = ntohl(y);
+            std::memcpy(&point.color, from + 8, 4);
+        }
+    });
+    return true;
+}
+}  // namespace
+
+// -- points ------------------------------------------------------------------
+bool
+read_points(
+        std::string const& file,
+        Color color,
+        std::vector<ColorPoint>& points)
+{
+    MappedFile mapped;
+    if (!mapped.open(file)) {
+        std::cerr << "Failed to open points file: " << file << std::endl;
+        return false;
+    }
+    std::size_t const size = mapped.size();
+    std::size_t const header = sizeof(points_magic) - 1;
+    if (size >= header && std::memcmp(mapped.data(), points_magic, header) == 0) {
+        if (!read_binary(mapped.data(), size, points)) {
+            std::cerr << "Truncated points file: " << file << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // pieces start after a line break, so no line is split
+    char const* data = reinterpret_cast<char const*>(mapped.data());
+    std::size_t const count = std::max<std::size_t>(
+                1, std::min(threads(), size / min_chunk_size));
+    std::vector<std::size_t> bounds(count + 1, size);
+    bounds.at(0) = 0;
+    for (std::size_t i = 1; i < count; ++i) {
+        std::size_t pos = std::max(bounds.at(i - 1), size / count * i);
+        while (pos < size && data[pos - 1] != '\n') {
+            ++pos;
+        }
+        bounds.at(i) = pos;
+    }
+    std::vector<Chunk> chunks(count);
+    parallel_for(count, count, [&] (std::size_t i)
+    {
+        parse_chunk(data, bounds.at(i), bounds.at(i + 1), chunks.at(i));
+    });
+
+    std::size_t total = points.size();
+    for (std::size_t i = 0; i < count; ++i) {
+        auto const& chunk = chunks.at(i);
+        if (chunk.error != bounds.at(i + 1)) {
+            auto const line = std::count(data, data + chunk.error, '\n') + 1;
+            std::cerr << "Invalid point at line " << line << " of " << file << std::endl;
+            return false;
+        }
+        total += chunk.points.size();
+    }
+    for (auto& chunk : chunks) {
+        for (auto const i : chunk.inherit) {
+            chunk.points.at(i).color = color;
+        }
+        if (chunk.has_color) {
+            color = chunk.color;
+        }
+        if (points.empty()) {
+            points.swap(chunk.points);
+            points.reserve(total);
+        } else {
+            points.insert(points.end(), chunk.points.begin(), chunk.points.end());
+        }
+    }
+    return true;
+}
+}  // namespace niu
@@ -0,0 +1,364 @@
+#include "image.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+#define NIU_SSE2 1
+#include <emmintrin.h>
+#endif  // x86
+
+#include "parallel.h"
+
+namespace niu {
+namespace {
+// ----------------------------------------------------------------------------
+double const pi = 3.14159265358979323846;
+
+// ----------------------------------------------------------------------------
+// Weights of the source pixels [first, first + weights.size()) for one
+// destination pixel; they always sum up to 1.
+struct Contribution
+{
+    std::size_t first = 0;
+    std::vector<float> weights = std::vector<float>();
+};
+
+// ----------------------------------------------------------------------------
+inline double
+sinc(double x)
+{
+    if (x == 0.0) {
+        return 1.0;
+    }
+    x *= pi;
+    return std::sin(x) / x;
+}
+
+// ----------------------------------------------------------------------------
+inline double
+filter_support(
+        ResampleFilter filter)
+{
+    switch (filter) {
+        case ResampleFilter::box :
+            return 0.5;
+        case ResampleFilter::bilinear :
+            return 1.0;
+        case ResampleFilter::bicubic :
+            return 2.0;
+        default :
+            return 3.0;
+    }
+}
+
+// ----------------------------------------------------------------------------
+inline double
+filter_weight(
+        ResampleFilter filter,
+        double x)
+{
+    x = std::fabs(x);
+    switch (filter) {
+        case ResampleFilter::box :
+            return x <= 0.5 ? 1.0 : 0.0;
+        case ResampleFilter::bilinear :
+            return x < 1.0 ? 1.0 - x : 0.0;
+        case ResampleFilter::bicubic :
+            // Catmull-Rom spline
+            if (x < 1.0) {
+                return (1.5 * x - 2.5) * x * x + 1.0;
+            }
+            if (x < 2.0) {
+                return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;
+            }
+            return 0.0;
+        default :
+            return x < 3.0 ? sinc(x) * sinc(x / 3.0) : 0.0;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Precomputes the separable filter weights for one axis. When shrinking the
+// filter is stretched by the scale so that every source pixel contributes.
+std::vector<Contribution>
+make_contributions(
+        std::size_t src_size,
+        std::size_t dst_size,
+        ResampleFilter filter)
+{
+    double const scale = static_cast<double>(src_size) / static_cast<double>(dst_size);
+    double const stretch = std::max(1.0, scale);
+    double const support = filter_support(filter) * stretch;
+    std::vector<Contribution> res(dst_size);
+    for (std::size_t i = 0; i < dst_size; ++i) {
+        double const center = (static_cast<double>(i) + 0.5) * scale;
+        auto const begin = static_cast<std::ptrdiff_t>(std::floor(center - support));
+        auto const end = static_cast<std::ptrdiff_t>(std::ceil(center + support));
+        auto const last = static_cast<std::ptrdiff_t>(src_size) - 1;
+        auto const first = std::max<std::ptrdiff_t>(0, std::min(begin, last));
+        std::vector<double> weights(static_cast<std::size_t>(
+                    std::min(end, last) - first + 1), 0.0);
+        double total = 0.0;
+        for (std::ptrdiff_t j = begin; j <= end; ++j) {
+            double const w = filter_weight(
+                        filter, (static_cast<double>(j) + 0.5 - center) / stretch);
+            if (w == 0.0) {
+                continue;
+            }
+            // pixels beyond the edges repeat the edge pixel
+            auto const index = std::max<std::ptrdiff_t>(0, std::min(j, last)) - first;
+            weights.at(static_cast<std::size_t>(index)) += w;
+            total += w;
+        }
+        auto& contribution = res.at(i);
+        contribution.first = static_cast<std::size_t>(first);
+        if (total == 0.0) {
+            // degenerate filter, fall back to the nearest pixel
+            auto const nearest = std::min(static_cast<std::size_t>(center), src_size - 1);
+            contribution.first = nearest;
+            contribution.weights.assign(1, 1.0f);
+            continue;
+        }
+        // trim zero weights at both ends
+        std::size_t lo = 0;
+        std::size_t hi = weights.size();
+        while (lo + 1 < hi && weights.at(lo) == 0.0) {
+            ++lo;
+        }
+        while (hi > lo + 1 && weights.at(hi - 1) == 0.0) {
+            --hi;
+        }
+        contribution.first += lo;
+        for (std::size_t j = lo; j < hi; ++j) {
+            contribution.weights.push_back(static_cast<float>(weights.at(j) / total));
+        }
+    }
+    return res;
+}
+
+#if defined(NIU_SSE2)
+// ----------------------------------------------------------------------------
+inline __m128
+load_premultiplied(
+        unsigned char const* src)
+{
+    int value;
+    std::memcpy(&value, src, sizeof(value));
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const wide = _mm_unpacklo_epi16(
+                _mm_unpacklo_epi8(_mm_cvtsi32_si128(value), zero), zero);
+    // scale color by alpha, keep alpha itself
+    float const alpha = src[3] / 255.0f;
+    return _mm_mul_ps(_mm_cvtepi32_ps(wide), _mm_set_ps(1.0f, alpha, alpha, alpha));
+}
+
+// ----------------------------------------------------------------------------
+inline void
+store_straight(
+        unsigned char* dst,
+        __m128 pixel)
+{
+    float const alpha = _mm_cvtss_f32(_mm_shuffle_ps(pixel, pixel, 0xff));
+    if (alpha > 0.0f) {
+        float const factor = 255.0f / std::min(255.0f, alpha);
+        pixel = _mm_mul_ps(pixel, _mm_set_ps(1.0f, factor, factor, factor));
+    } else {
+        pixel = _mm_setzero_ps();
+    }
+    // pack with saturation clamps every channel to [0, 255]
+    __m128i const wide = _mm_cvtps_epi32(pixel);
+    __m128i const narrow = _mm_packus_epi16(_mm_packs_epi32(wide, wide), wide);
+    int const value = _mm_cvtsi128_si32(narrow);
+    std::memcpy(dst, &value, sizeof(value));
+}
+#endif  // NIU_SSE2
+
+// ----------------------------------------------------------------------------
+// horizontal pass: one source row into premultiplied float pixels
+void
+resample_row(
+        unsigned char const* src,
+        std::vector<Contribution> const& contributions,
+        float* dst)
+{
+    for (auto const& c : contributions) {
+        unsigned char const* pixel = src + c.first * Image::channels;
+#if defined(NIU_SSE2)
+        __m128 sum = _mm_setzero_ps();
+        for (std::size_t j = 0; j < c.weights.size(); ++j, pixel += Image::channels) {
+            sum = _mm_add_ps(sum, _mm_mul_ps(load_premultiplied(pixel),
+                                             _mm_set1_ps(c.weights[j])));
+        }
+        _mm_storeu_ps(dst, sum);
+#else
+        float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        for (std::size_t j = 0; j < c.weights.size(); ++j, pixel += Image::channels) {
+            float const w = c.weights[j];
+            float const alpha = pixel[3] / 255.0f;
+            for (std::size_t k = 0; k < 3; ++k) {
+                sum[k] += w * pixel[k] * alpha;
+            }
+            sum[3] += w * pixel[3];
+        }
+        std::memcpy(dst, sum, sizeof(sum));
+#endif  // NIU_SSE2
+        dst += Image::channels;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// vertical pass: weighted rows of the horizontal pass into straight RGBA,
+// rows[j] being the row for c.weights[j]
+void
+resample_column(
+        float const* const* rows,
+        Contribution const& c,
+        std::size_t width,
+        unsigned char* dst)
+{
+    for (std::size_t x = 0; x < width; ++x, dst += Image::channels) {
+        std::size_t const offset = x * Image::channels;
+#if defined(NIU_SSE2)
+        __m128 sum = _mm_setzero_ps();
+        for (std::size_t j = 0; j < c.weights.size(); ++j) {
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows[j] + offset),
+                                             _mm_set1_ps(c.weights[j])));
+        }
+        store_straight(dst, sum);
+#else
+        float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        for (std::size_t j = 0; j < c.weights.size(); ++j) {
+            for (std::size_t k = 0; k < 4; ++k) {
+                sum[k] += c.weights[j] * rows[j][offset + k];
+            }
+        }
+        float const alpha = std::min(255.0f, std::max(0.0f, sum[3]));
+        for (std::size_t k = 0; k < 4; ++k) {
+            float const value = alpha > 0.0f ? (k < 3 ? sum[k] * 255.0f / alpha : alpha)
+                                             : 0.0f;
+            dst[k] = static_cast<unsigned char>(
+                        std::min(255.0f, std::max(0.0f, std::nearbyint(value))));
+        }
+#endif  // NIU_SSE2
+    }
+}
+
+// ----------------------------------------------------------------------------
+// exact 2x2 box average of one output row, alpha weighted
+void
+halve_row(
+        unsigned char const* top,
+        unsigned char const* bottom,
+        std::size_t width,
+        unsigned char* dst)
+{
+    for (std::size_t x = 0; x < width; ++x, top += 8, bottom += 8, dst += 4) {
+        unsigned const alpha = 0u + top[3] + top[7] + bottom[3] + bottom[7];
+        if (alpha == 0) {
+            std::memset(dst, 0, 4);
+            continue;
+        }
+        for (std::size_t k = 0; k < 3; ++k) {
+            unsigned const sum = 0u + top[k] * top[3] + top[k + 4] * top[7]
+                    + bottom[k] * bottom[3] + bottom[k + 4] * bottom[7];
+            dst[k] = static_cast<unsigned char>((sum + alpha / 2) / alpha);
+        }
+        dst[3] = static_cast<unsigned char>((alpha + 2) / 4);
+    }
+}
+}  // namespace
+
+// ----------------------------------------------------------------------------
+Image
+Image::resized(
+        std::size_t width,
+        std::size_t height,
+        ResampleFilter filter) const
+{
+    if ((width == 0 && height == 0) || !m_data) {
+        throw std::invalid_argument("invalid resize parameters");
+    }
+    // zero side keeps the aspect ratio
+    if (width == 0) {
+        width = std::max<std::size_t>(1, (m_width * height + m_height / 2) / m_height);
+    } else if (height == 0) {
+        height = std::max<std::size_t>(1, (m_height * width + m_width / 2) / m_width);
+    }
+    if (filter == ResampleFilter::box && m_width == width * 2 && m_height == height * 2) {
+        // mipmap case: every output pixel is the average of a 2x2 block
+        Image res = make_uninitialized(width, height);
+        unsigned char const* src = m_data.get();
+        unsigned char* dst = res.m_data.get();
+        std::size_t const src_stride = m_width * channels;
+        parallel_bands(height, [=] (std::size_t begin, std::size_t end)
+        {
+            for (std::size_t y = begin; y < end; ++y) {
+                unsigned char const* top = src + 2 * y * src_stride;
+                halve_row(top, top + src_stride, width, dst + y * width * channels);
+            }
+        });
+        return res;
+    }
+    auto const horizontal = make_contributions(m_width, width, filter);
+    auto const vertical = make_contributions(m_height, height, filter);
+    Image res = make_uninitialized(width, height);
+
+    // the horizontal pass fills a ring of source rows per band of output
+    // rows, large enough for the widest vertical window, so memory does not
+    // grow with the image height
+    std::size_t window = 0;
+    for (auto const& c : vertical) {
+        window = std::max(window, c.weights.size());
+    }
+    std::size_t const stride = width * channels;
+    unsigned char const* src = m_data.get();
+    std::size_t const src_stride = m_width * channels;
+    unsigned char* dst = res.m_data.get();
+    parallel_bands(height, [&] (std::size_t begin, std::size_t end)
+    {
+        std::vector<float> ring(stride * window);
+        // source row held by each slot
+        std::vector<std::size_t> held(window, m_height);
+        std::vector<float const*> rows(window);
+        for (std::size_t y = begin; y < end; ++y) {
+            auto const& c = vertical.at(y);
+            for (std::size_t j = 0; j < c.weights.size(); ++j) {
+                std::size_t const row = c.first + j;
+                std::size_t const slot = row % window;
+                float* buffer = ring.data() + slot * stride;
+                if (held.at(slot) != row) {
+                    resample_row(src + row * src_stride, horizontal, buffer);
+                    held.at(slot) = row;
+                }
+                rows.at(j) = buffer;
+            }
+            resample_column(rows.data(), c, width, dst + y * stride);
+        }
+    });
+    return res;
+}
+
+// ----------------------------------------------------------------------------
+std::vector<Image>
+Image::pyramid(
+        std::size_t levels,
+        ResampleFilter filter) const
+{
+    std::vector<Image> res;
+    while (levels == 0 || res.size() < levels) {
+        Image const& prev = res.empty() ? *this : res.back();
+        if (prev.width() == 1 && prev.height() == 1) {
+            break;
+        }
+        // each level is derived from the previous one, not from the source
+        Image next = prev.resized(std::max<std::size_t>(1, prev.width() / 2),
+                                  std::max<std::size_t>(1, prev.height() / 2), filter);
+        res.push_back(next);
+    }
+    return res;
+}
+}  // namespace niu
@@ -0,0 +1,325 @@
+#include "tiled_image.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define NIU_MMAP 1
+#include <sys/mman.h>
+#include <unistd.h>
+#endif  // __unix__ || __APPLE__
+
+#include "allocator.h"
+#include "decoder.h"
+#include "kernels.h"
+#include "parallel.h"
+
+namespace niu {
+namespace {
+// ----------------------------------------------------------------------------
+std::size_t const tile_row_size = TiledImage::tile_size * Image::channels;
+std::size_t const tile_bytes = TiledImage::tile_size * tile_row_size;
+
+// ----------------------------------------------------------------------------
+inline std::size_t
+tile_count(std::size_t size)
+{
+    return (size + TiledImage::tile_size - 1) / TiledImage::tile_size;
+}
+
+#if defined(NIU_MMAP)
+// ----------------------------------------------------------------------------
+// maps a sparse scratch file of 'size' bytes, nullptr on failure
+void*
+map_scratch(
+        std::string dir,
+        std::size_t size)
+{
+    if (dir.empty()) {
+        char const* tmp = std::getenv("TMPDIR");
+        dir = tmp && *tmp ? tmp : "/tmp";
+    }
+    std::string name = dir + "/niu-XXXXXX";
+    std::vector<char> path(name.begin(), name.end());
+    path.push_back('\0');
+    int const fd = mkstemp(path.data());
+    if (fd < 0) {
+        return nullptr;
+    }
+    // the file is gone as soon as the mapping is
+    unlink(path.data());
+    void* res = nullptr;
+    if (ftruncate(fd, static_cast<off_t>(size)) == 0) {
+        res = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (res == MAP_FAILED) {
+            res = nullptr;
+        }
+    }
+    close(fd);
+    return res;
+}
+#endif  // NIU_MMAP
+}  // namespace
+
+// -- TiledImage implementation -----------------------------------------------
+TiledImage::TiledImage(
+        std::size_t width,
+        std::size_t height,
+        std::size_t ram_budget,
+        std::string const& scratch_dir)
+    : m_width(width),
+      m_height(height),
+      m_columns(tile_count(width)),
+      m_tiles(),
+      m_buffers(),
+      m_map(nullptr),
+      m_map_size(0)
+{
+    if (width == 0 || height == 0) {
+        throw std::invalid_argument("invalid image parameters");
+    }
+    std::size_t const rows = tile_count(height);
+    if (m_columns > std::numeric_limits<std::size_t>::max() / rows
+            || m_columns * rows > std::numeric_limits<std::size_t>::max() / tile_bytes) {
+        throw std::overflow_error("integer overflow");
+    }
+    std::size_t const count = m_columns * rows;
+    m_tiles.resize(count);
+    if (ram_budget != 0 && count * tile_bytes > ram_budget) {
+#if defined(NIU_MMAP)
+        m_map = map_scratch(scratch_dir, count * tile_bytes);
+        if (!m_map) {
+            throw std::runtime_error("can't map scratch file in '" + scratch_dir + "'");
+        }
+        m_map_size = count * tile_bytes;
+#endif  // NIU_MMAP
+    }
+    if (!m_map) {
+        m_buffers.resize(count);
+    }
+}
+
+// ----------------------------------------------------------------------------
+TiledImage::~TiledImage()
+{
+#if defined(NIU_MMAP)
+    if (m_map) {
+        munmap(m_map, m_map_size);
+    }
+#endif  // NIU_MMAP
+}
+
+// ----------------------------------------------------------------------------
+unsigned char*
+TiledImage::tile_data(
+        std::size_t index,
+        bool keep)
+{
+    auto& tile = m_tiles.at(index);
+    if (!tile.data) {
+        if (m_map) {
+            tile.data = static_cast<unsigned char*>(m_map) + index * tile_bytes;
+        } else {
+            m_buffers.at(index) = allocate_buffer(tile_bytes, false);
+            tile.data = m_buffers.at(index).get();
+        }
+        if (keep) {
+            kernels::fill(tile.data, tile_size * tile_size, tile.color);
+        }
+    }
+    return tile.data;
+}
+
+// ----------------------------------------------------------------------------
+bool
+TiledImage::load(
+        std::string const& file)
+{
+    ImageInfo info;
+    if (!Image::probe(file, info)) {
+        return false;
+    }
+    if (info.width != m_width || info.height != m_height) {
+        std::cerr << "Image size doesn't match: " << file << std::endl;
+        return false;
+    }
+    if (info.format != Format::png) {
+        Image image;
+        if (!image.load(file)) {
+            return false;
+        }
+        merge(image, Point{ }, BlendMode::copy);
+        return true;
+    }
+    // every row of the image is written, so tiles are not filled first
+    return read_png_rows(file, [this] (std::size_t y, unsigned char const* row)
+    {
+        std::size_t const offset = (y % tile_size) * tile_row_size;
+        for (std::size_t column = 0; column < m_columns; ++column) {
+            std::size_t const x = column * tile_size;
+            std::size_t const w = std::min(tile_size, m_width - x);
+            std::memcpy(tile_data((y / tile_size) * m_columns + column, false) + offset,
+                        row + x * Image::channels, w * Image::channels);
+        }
+    });
+}
+
+// ----------------------------------------------------------------------------
+bool
+TiledImage::save(
+        std::string const& file,
+        Format format,
+        EncodeOptions const& options) const
+{
+    return Image::save_rows(file, m_width, m_height,
+                            [this] (std::size_t y, unsigned char* buffer)
+    {
+        std::size_t const row = y / tile_size;
+        std::size_t const offset = (y % tile_size) * tile_row_size;
+        for (std::size_t column = 0; column < m_columns; ++column) {
+            auto const& tile = m_tiles.at(row * m_columns + column);
+            std::size_t const x = column * tile_size;
+            std::size_t const w = std::min(tile_size, m_width - x);
+            unsigned char* dst = buffer + x * Image::channels;
+            if (tile.data) {
+                std::memcpy(dst, tile.data + offset, w * Image::channels);
+            } else {
+                kernels::fill(dst, w, tile.color);
+            }
+        }
+        return static_cast<unsigned char const*>(buffer);
+    }, format, options);
+}
+
+// ----------------------------------------------------------------------------
+void
+TiledImage::merge(
+        Image const& image,
+        Point const& offset,
+        BlendMode mode)
+{
+    merge(image.view(), offset, mode);
+}
+
+// ----------------------------------------------------------------------------
+void
+TiledImage::merge(
+        ImageView const& image,
+        Point const& pos,
+        BlendMode mode)
+{
+    // the overlay may hang over any edge of the canvas
+    std::size_t sx, sy, dx, dy, w, h;
+    clip_span(pos.x, image.width(), m_width, sx, dx, w);
+    clip_span(pos.y, image.height(), m_height, sy, dy, h);
+    if (w == 0 || h == 0) {
+        return;
+    }
+    std::size_t const first_row = dy / tile_size;
+    std::size_t const last_row = (dy + h - 1) / tile_size;
+    std::size_t const first_column = dx / tile_size;
+    std::size_t const last_column = (dx + w - 1) / tile_size;
+    // tiles are independent, rows of tiles go to separate workers
+    parallel_bands(last_row - first_row + 1, [&] (std::size_t begin, std::size_t end)
+    {
+        for (std::size_t row = first_row + begin; row < first_row + end; ++row) {
+            std::size_t const y0 = std::max(dy, row * tile_size);
+            std::size_t const y1 = std::min(dy + h, (row + 1) * tile_size);
+            for (std::size_t column = first_column; column <= last_column; ++column) {
+                std::size_t const x0 = std::max(dx, column * tile_size);
+                std::size_t const x1 = std::min(dx + w, (column + 1) * tile_size);
+                // a copy over the whole visible tile leaves nothing to fill
+                bool const covered = mode == BlendMode::copy
+                        && x0 == column * tile_size && y0 == row * tile_size
+                        && x1 == std::min(m_width, (column + 1) * tile_size)
+                        && y1 == std::min(m_height, (row + 1) * tile_size);
+                unsigned char* data = tile_data(row * m_columns + column, !covered);
+                for (std::size_t y = y0; y < y1; ++y) {
+                    unsigned char const* src = image.row(sy + y - dy)
+                            + (sx + x0 - dx) * Image::channels;
+                    unsigned char* dst = data + (y - row * tile_size) * tile_row_size
+                            + (x0 - column * tile_size) * Image::channels;
+                    switch (mode) {
+                        case BlendMode::mask :
+                            kernels::merge_masked(dst, src, x1 - x0);
+                            break;
+                        case BlendMode::copy :
+                            std::memmove(dst, src, (x1 - x0) * Image::channels);
+                            break;
+                        default :
+                            kernels::blend(dst, src, x1 - x0, mode);
+                            break;
+                    }
+                }
+            }
+        }
+    });
+}
+
+// ----------------------------------------------------------------------------
+void
+TiledImage::set_color(
+        std::size_t x,
+        std::size_t y,
+        Color color)
+{
+    if (x >= m_width || y >= m_height) {
+        throw std::invalid_argument("invalid image parameters");
+    }
+    unsigned char* data = tile_data((y / tile_size) * m_columns + x / tile_size);
+    std::memcpy(data + (y % tile_size) * tile_row_size
+                + (x % tile_size) * Image::channels, &color, Image::channels);
+}
+
+// ----------------------------------------------------------------------------
+void
+TiledImage::fill(
+        Color color)
+{
+    // tiles fall back to a single color, storage is taken again on write
+    for (std::size_t i = 0; i < m_tiles.size(); ++i) {
+        m_tiles.at(i).data = nullptr;
+        m_tiles.at(i).color = color;
+        if (!m_map) {
+            m_buffers.at(i).reset();
+        }
+    }
+#if defined(NIU_MMAP)
+    // gives the pages of the scratch file back, where the file system can
+    // punch holes; otherwise they are at least dropped from memory
+    if (m_map) {
+#if defined(MADV_REMOVE)
+        if (madvise(m_map, m_map_size, MADV_REMOVE) == 0) {
+            return;
+        }
+#endif  // MADV_REMOVE
+        madvise(m_map, m_map_size, MADV_DONTNEED);
+    }
+#endif  // NIU_MMAP
+}
+
+// ----------------------------------------------------------------------------
+std::size_t
+TiledImage::width() const noexcept
+{
+    return m_width;
+}
+
+// ----------------------------------------------------------------------------
+std::size_t
+TiledImage::height() const noexcept
+{
+    return m_height;
+}
+
+// ----------------------------------------------------------------------------
+bool
+TiledImage::is_mapped() const noexcept
+{
+    return m_map != nullptr;
+}
+}  // namespace niu
@@ -0,0 +1,160 @@
+#include "image.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "kernels.h"
+#include "parallel.h"
+
+namespace niu {
+namespace {
+// ----------------------------------------------------------------------------
+// Side of the square blocks transposed at once: 64 source rows and 64
+// destination rows of 256 bytes each stay in L1 cache while a block is done.
+std::size_t const block_size = 64;
+
+// ----------------------------------------------------------------------------
+// Transposes 'src' block by block; 'dst' points at the destination of source
+// pixel (0, 0), see kernels::transpose. Workers take columns of blocks, so
+// each one writes its own band of destination rows.
+void
+transpose_blocks(
+        unsigned char* dst,
+        std::ptrdiff_t dst_stride,
+        bool reverse,
+        unsigned char const* src,
+        std::size_t width,
+        std::size_t height)
+{
+    std::size_t const src_stride = width * Image::channels;
+    std::ptrdiff_t const pixel = static_cast<std::ptrdiff_t>(Image::channels);
+    std::ptrdiff_t const step = reverse ? -pixel : pixel;
+    std::size_t const columns = (width + block_size - 1) / block_size;
+    parallel_bands(columns, [=] (std::size_t begin, std::size_t end)
+    {
+        for (std::size_t bx = begin; bx < end; ++bx) {
+            std::size_t const x = bx * block_size;
+            std::size_t const w = std::min(block_size, width - x);
+            for (std::size_t y = 0; y < height; y += block_size) {
+                std::size_t const h = std::min(block_size, height - y);
+                kernels::transpose(dst + static_cast<std::ptrdiff_t>(x) * dst_stride
+                                       + static_cast<std::ptrdiff_t>(y) * step,
+                                   dst_stride, reverse,
+                                   src + y * src_stride + x * Image::channels,
+                                   src_stride, w, h);
+            }
+        }
+    });
+}
+}  // namespace
+
+// -- Image transforms --------------------------------------------------------
+void
+Image::inverse_x()
+{
+    detach(true);
+    unsigned char* data = m_data.get();
+    std::size_t const width = m_width;
+    parallel_bands(m_height, [=] (std::size_t begin, std::size_t end)
+    {
+        for (std::size_t y = begin; y < end; ++y) {
+            kernels::reverse(data + y * width * channels, width);
+        }
+    });
+}
+
+// ----------------------------------------------------------------------------
+void
+Image::inverse_y()
+{
+    detach(true);
+    unsigned char* data = m_data.get();
+    std::size_t const stride = m_width * channels;
+    std::size_t const height = m_height;
+    parallel_bands(height / 2, [=] (std::size_t begin, std::size_t end)
+    {
+        for (std::size_t y = begin; y < end; ++y) {
+            unsigned char* top = data + y * stride;
+            std::swap_ranges(top, top + stride, data + (height - y - 1) * stride);
+        }
+    });
+}
+
+// ----------------------------------------------------------------------------
+void
+Image::transpose()
+{
+    Image res = transposed();
+    std::swap(*this, res);
+}
+
+// ----------------------------------------------------------------------------
+Image
+Image::transposed() const
+{
+    if (!m_data) {
+        return Image();
+    }
+    Image res = make_uninitialized(m_height, m_width);
+    transpose_blocks(res.m_data.get(), static_cast<std::ptrdiff_t>(m_height * channels),
+                     false, m_data.get(), m_width, m_height);
+    return res;
+}
+
+// ----------------------------------------------------------------------------
+void
+Image::rotate(
+        int degrees)
+{
+    Image res = rotated(degrees);
+    std::swap(*this, res);
+}
+
+// ----------------------------------------------------------------------------
+Image
+Image::rotated(
+        int degrees) const
+{
+    if (degrees % 90 != 0) {
+        throw std::invalid_argument("rotation must be a multiple of 90 degrees");
+    }
+    int const turns = (degrees / 90 % 4 + 4) % 4;
+    if (!m_data || turns == 0) {
+        return *this;
+    }
+    if (turns % 2 != 0 && (m_width == 0 || m_height == 0)) {
+        return make_image(m_height, m_width);
+    }
+    std::ptrdiff_t const dst_stride = static_cast<std::ptrdiff_t>(m_height * channels);
+    if (turns == 1) {
+        // pixel (x, y) goes to (height - 1 - y, x)
+        Image res = make_uninitialized(m_height, m_width);
+        transpose_blocks(res.m_data.get() + (m_height - 1) * channels, dst_stride, true,
+                         m_data.get(), m_width, m_height);
+        return res;
+    }
+    if (turns == 3) {
+        // pixel (x, y) goes to (y, width - 1 - x)
+        Image res = make_uninitialized(m_height, m_width);
+        transpose_blocks(res.m_data.get() + (m_width - 1) * m_height * channels,
+                         -dst_stride, false, m_data.get(), m_width, m_height);
+        return res;
+    }
+    Image res = make_uninitialized(m_width, m_height);
+    unsigned char const* src = m_data.get();
+    unsigned char* dst = res.m_data.get();
+    std::size_t const width = m_width;
+    std::size_t const height = m_height;
+    parallel_bands(height, [=] (std::size_t begin, std::size_t end)
+    {
+        std::size_t const stride = width * channels;
+        for (std::size_t y = begin; y < end; ++y) {
+            unsigned char* row = dst + (height - y - 1) * stride;
+            std::memcpy(row, src + y * stride, stride);
+            kernels::reverse(row, width);
+        }
+    });
+    return res;
+}
+}  // namespace niu